@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,22 +55,76 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+struct block_request;
+typedef void block_complete_func (struct block_request *);
+
+/* A request to move a range of sectors between a block device
+   and memory.  The submitter owns the request and must keep it
+   alive until it completes. */
+struct block_request
+  {
+    /* Set by block_request_init(). */
+    bool write;                         /* Write if true, else read. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_complete_func *complete;      /* Completion callback, or null. */
+    void *aux;                          /* For use by COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct list_elem elem;              /* Element in a device queue. */
+    int64_t deadline;                   /* Dispatch by this tick. */
+    struct semaphore done;              /* Up'd on completion. */
+    struct block *block;                /* Device charged for REQ. */
+    uint64_t start;                     /* timer_cycles() at submission. */
+    unsigned depth;                     /* Requests in flight ahead of it. */
+    unsigned trace_seq;                 /* Sequence number in trace. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_complete_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* A driver provides either SUBMIT, which takes over queuing and
+   must eventually pass each request to block_complete(), or READ
+   and WRITE (and optionally READ_MULTIPLE and WRITE_MULTIPLE),
+   which the block layer calls from a per-device dispatcher thread
+   in elevator order. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer falls back to one call to read or
+       write per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Accepts a request, with its sector relative to
+       this device, in place of the block layer's queue. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
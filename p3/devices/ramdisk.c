@@ -0,0 +1,78 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device backed by kernel memory.
+
+   The disk's contents live in a run of contiguous pages
+   obtained from the kernel pool at boot, so every "transfer" is
+   just a memcpy().  That makes it useful for measuring the CPU
+   cost of the file system or of paging with the disk latency
+   taken out of the picture, and as a fast swap device. */
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    uint8_t *base;              /* First byte of disk contents. */
+    size_t page_cnt;            /* Number of pages in BASE. */
+  };
+
+/* We support a single RAM disk. */
+static struct ramdisk ramdisk;
+
+static struct block_operations ramdisk_operations;
+
+/* Allocates a RAM disk of SIZE_KB kilobytes, rounded up to a
+   whole number of pages, and registers it with the block layer
+   as device "rd0" with type ROLE, so that it is found for ROLE
+   ahead of any IDE disk. */
+void
+ramdisk_init (enum block_type role, size_t size_kb)
+{
+  struct ramdisk *rd = &ramdisk;
+  block_sector_t size;
+
+  ASSERT (role == BLOCK_FILESYS || role == BLOCK_SCRATCH
+          || role == BLOCK_SWAP);
+  ASSERT (rd->base == NULL);
+
+  rd->page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  if (rd->page_cnt == 0)
+    PANIC ("rd0: size must be nonzero");
+  rd->base = palloc_get_multiple (PAL_ZERO, rd->page_cnt);
+  if (rd->base == NULL)
+    PANIC ("rd0: cannot allocate %zu pages of RAM disk", rd->page_cnt);
+
+  size = rd->page_cnt * (PGSIZE / BLOCK_SECTOR_SIZE);
+  block_register ("rd0", role, "RAM disk", size, &ramdisk_operations, rd);
+}
+
+/* Carries out REQ on RAM disk RD at once, in the submitting
+   thread.  There is no seek time to save by queuing, and no
+   latency to hide, so the request completes before this function
+   returns.
+   No locking is needed: a sector is only ever copied as a whole,
+   and the block layer's clients do not access one sector from
+   two threads at once. */
+static void
+ramdisk_submit (void *rd_, struct block_request *req)
+{
+  struct ramdisk *rd = rd_;
+  uint8_t *sectors = rd->base + req->sector * BLOCK_SECTOR_SIZE;
+  size_t size = req->cnt * BLOCK_SECTOR_SIZE;
+
+  if (req->write)
+    memcpy (sectors, req->buffer, size);
+  else
+    memcpy (req->buffer, sectors, size);
+  block_complete (req);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    .submit = ramdisk_submit
+  };
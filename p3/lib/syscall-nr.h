@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_MSYNC,                  /* Write back a memory mapping. */
+    SYS_SET_RSS_LIMIT,          /* Limit resident memory. */
+    SYS_VMSTAT                  /* Get paging statistics. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,27 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+msync (mapid_t mapid, int flags)
+{
+  return syscall2 (SYS_MSYNC, mapid, flags);
+}
+
+void
+set_rss_limit (unsigned pages)
+{
+  syscall1 (SYS_SET_RSS_LIMIT, pages);
+}
+
+bool
+vmstat (struct vmstat *stats)
+{
+  return syscall1 (SYS_VMSTAT, stats);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -12,6 +13,11 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Flags for msync(). */
+#define MS_ASYNC 1              /* Schedule the write-back. */
+#define MS_INVALIDATE 2         /* Invalidate other copies. */
+#define MS_SYNC 4               /* Write back before returning. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -45,4 +51,10 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+bool msync (mapid_t, int flags);
+void set_rss_limit (unsigned pages);
+bool vmstat (struct vmstat *);
+
 #endif /* lib/user/syscall.h */
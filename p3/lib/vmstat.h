@@ -0,0 +1,18 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+/* Paging statistics of a process, from vmstat(). */
+struct vmstat
+  {
+    unsigned faults;            /* Page faults taken. */
+    unsigned file_faults;       /* Pages read in from files. */
+    unsigned cached_faults;     /* Pages found in the page cache. */
+    unsigned swap_faults;       /* Pages read in from swap. */
+    unsigned stack_faults;      /* Stack pages added. */
+    unsigned zero_faults;       /* Reads that mapped the zero page. */
+    unsigned cow_faults;        /* Writes to copy-on-write pages. */
+    unsigned evictions;         /* Pages evicted. */
+    unsigned long long fault_cycles; /* CPU cycles in the fault handler. */
+  };
+
+#endif /* lib/vmstat.h */
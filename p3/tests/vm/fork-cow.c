@@ -0,0 +1,47 @@
+/* Forks a child that overwrites a large array and a stack
+   variable it shares with its parent, then checks that each
+   process sees only its own writes. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  volatile int on_stack = 0x1234;
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  CHECK ((child = fork ()) != -1, "fork");
+  if (child == 0)
+    {
+      /* Child: see the parent's data, then write over it. */
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          exit (1);
+      for (i = 0; i < SIZE; i++)
+        buf[i] = i % 13;
+      on_stack = 0x5678;
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 13))
+          exit (2);
+      exit (on_stack == 0x5678 ? 0x42 : 3);
+    }
+
+  CHECK (wait (child) == 0x42, "wait for child");
+
+  msg ("check data");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu is %d after child wrote it", i, buf[i]);
+  if (on_stack != 0x1234)
+    fail ("stack variable changed by child");
+}
@@ -0,0 +1,34 @@
+/* Writes to a file through a mapping and msyncs it, then reads
+   the data in the file back using the read system call while the
+   file is still mapped, to verify that msync wrote it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, strlen (sample));
+  CHECK (!msync (map + 1, MS_SYNC), "msync unmapped id");
+  CHECK (!msync (map, MS_SYNC | MS_ASYNC), "msync with bad flags");
+  CHECK (msync (map, MS_SYNC), "msync \"sample.txt\"");
+
+  /* Read back via read(), still mapped. */
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  munmap (map);
+  close (handle);
+}
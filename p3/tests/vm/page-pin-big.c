@@ -0,0 +1,41 @@
+/* Limits the process to 16 frames, then writes a 512 kB buffer, 8
+   times larger than the limit, to a file and reads it back into
+   another buffer in single system calls.  The buffers cannot all
+   be in memory at once, so the system calls must bring their pages
+   in and let them go again a part at a time.  Verifies the data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (512 * 1024)
+
+static char src[SIZE];
+static char dst[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  for (i = 0; i < SIZE; i++)
+    src[i] = i % 251;
+
+  set_rss_limit (16);
+
+  CHECK (create ("pinned", SIZE), "create \"pinned\"");
+  CHECK ((fd = open ("pinned")) > 1, "open \"pinned\"");
+  if (write (fd, src, SIZE) != SIZE)
+    fail ("write \"pinned\" failed");
+  seek (fd, 0);
+  if (read (fd, dst, SIZE) != SIZE)
+    fail ("read \"pinned\" failed");
+  close (fd);
+
+  msg ("compare buffers");
+  for (i = 0; i < SIZE; i++)
+    if (dst[i] != (char) (i % 251))
+      fail ("byte %zu != %d", i, (int) (i % 251));
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-pin-big) begin
+(page-pin-big) create "pinned"
+(page-pin-big) open "pinned"
+(page-pin-big) compare buffers
+(page-pin-big) end
+EOF
+pass;
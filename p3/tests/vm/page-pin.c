@@ -0,0 +1,41 @@
+/* Limits the process to 8 frames, then writes a 64 kB buffer to a
+   file and reads it back into another buffer in single system
+   calls, so that the pages of the buffers must be brought in and
+   kept in memory while the file system copies to and from them,
+   and verifies the data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char src[SIZE];
+static char dst[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  for (i = 0; i < SIZE; i++)
+    src[i] = i % 251;
+
+  set_rss_limit (8);
+
+  CHECK (create ("pinned", SIZE), "create \"pinned\"");
+  CHECK ((fd = open ("pinned")) > 1, "open \"pinned\"");
+  if (write (fd, src, SIZE) != SIZE)
+    fail ("write \"pinned\" failed");
+  seek (fd, 0);
+  if (read (fd, dst, SIZE) != SIZE)
+    fail ("read \"pinned\" failed");
+  close (fd);
+
+  msg ("compare buffers");
+  for (i = 0; i < SIZE; i++)
+    if (dst[i] != (char) (i % 251))
+      fail ("byte %zu != %d", i, (int) (i % 251));
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-pin) begin
+(page-pin) create "pinned"
+(page-pin) open "pinned"
+(page-pin) compare buffers
+(page-pin) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Limits the process to 32 frames, then writes and reads back
+   256 kB of memory, which has to be paged against the process's
+   own frames, and verifies that the values are as they should
+   be.  Checks with vmstat() that each pass really had to evict
+   and fault pages, as it would not if the limit were ignored. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (256 * 1024)
+#define PAGE_CNT (SIZE / 4096)
+#define RSS_LIMIT 32
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  struct vmstat before, mid, after;
+  size_t i;
+
+  set_rss_limit (RSS_LIMIT);
+  CHECK (vmstat (&before), "vmstat");
+
+  /* Write a pattern that differs from page to page. */
+  msg ("write pass");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+  CHECK (vmstat (&mid), "vmstat after write pass");
+
+  /* Check it. */
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu != %d", i, (int) (i % 251));
+  CHECK (vmstat (&after), "vmstat after read pass");
+
+  /* At most RSS_LIMIT of the pages can be resident at once. */
+  if (mid.evictions - before.evictions < PAGE_CNT - RSS_LIMIT)
+    fail ("%u evictions in write pass, expected at least %d",
+          mid.evictions - before.evictions, PAGE_CNT - RSS_LIMIT);
+  if (after.faults - mid.faults < PAGE_CNT - RSS_LIMIT)
+    fail ("%u faults in read pass, expected at least %d",
+          after.faults - mid.faults, PAGE_CNT - RSS_LIMIT);
+  msg ("counts match");
+}
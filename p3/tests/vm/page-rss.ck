@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-rss) begin
+(page-rss) vmstat
+(page-rss) write pass
+(page-rss) vmstat after write pass
+(page-rss) read pass
+(page-rss) vmstat after read pass
+(page-rss) counts match
+(page-rss) end
+EOF
+pass;
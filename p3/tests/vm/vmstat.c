@@ -0,0 +1,38 @@
+/* Reads, then writes, 16 pages of BSS, and checks that vmstat()
+   counts a zero-page fault for each read and a copy-on-write
+   fault for each write. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 16
+
+static char buf[PAGE_CNT * 4096] __attribute__ ((aligned (4096)));
+
+void
+test_main (void)
+{
+  struct vmstat before, mid, after;
+  volatile char sum = 0;
+  size_t i;
+
+  CHECK (vmstat (&before), "vmstat");
+  for (i = 0; i < PAGE_CNT; i++)
+    sum += buf[i * 4096];
+  CHECK (vmstat (&mid), "vmstat after reads");
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * 4096] = sum + 1;
+  CHECK (vmstat (&after), "vmstat after writes");
+
+  if (after.faults - before.faults < 2 * PAGE_CNT)
+    fail ("%u faults, expected at least %d", after.faults - before.faults,
+          2 * PAGE_CNT);
+  if (mid.zero_faults - before.zero_faults < PAGE_CNT)
+    fail ("%u zero-page faults, expected %d",
+          mid.zero_faults - before.zero_faults, PAGE_CNT);
+  if (after.cow_faults - mid.cow_faults < PAGE_CNT)
+    fail ("%u copy-on-write faults, expected %d",
+          after.cow_faults - mid.cow_faults, PAGE_CNT);
+  msg ("counts match");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vmstat) begin
+(vmstat) vmstat
+(vmstat) vmstat after reads
+(vmstat) vmstat after writes
+(vmstat) counts match
+(vmstat) end
+EOF
+pass;
@@ -29,6 +29,8 @@
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
 #include "vm/swap.h"
 #else
 #include "tests/threads/tests.h"
@@ -36,6 +38,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -54,6 +57,10 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk=ROLE:KB: Role and size of the RAM disk, if any. */
+static enum block_type ramdisk_role;
+static size_t ramdisk_size_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -68,6 +75,7 @@ static void run_actions (char **argv);
 static void usage (void);
 
 #ifdef FILESYS
+static void configure_ramdisk (char *value);
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
 #endif
@@ -100,6 +108,11 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  vm_frame_table_init ();
+  page_init ();
+  mmap_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -125,14 +138,16 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  if (ramdisk_size_kb > 0)
+    ramdisk_init (ramdisk_role, ramdisk_size_kb);
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
 
 #ifdef VM
-  vm_frame_table_init ();
   swap_init ();
+  vm_pageout_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -258,7 +273,13 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-fault-around"))
+        page_fault_around = atoi (value);
+      else if (!strcmp (name, "-vmstat"))
+        process_print_vmstat = true;
 #endif
+      else if (!strcmp (name, "-ramdisk"))
+        configure_ramdisk (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -383,7 +404,10 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -fault-around=N    Read up to N pages ahead on file page faults.\n"
+          "  -vmstat            Print paging statistics as processes exit.\n"
 #endif
+          "  -ramdisk=ROLE:KB   Create a KB-kilobyte RAM disk for ROLE.\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
@@ -395,6 +419,31 @@ usage (void)
 }
 
 #ifdef FILESYS
+/* Parses VALUE, the argument to -ramdisk, which has the form
+   ROLE:KB, e.g. "swap:4096". */
+static void
+configure_ramdisk (char *value)
+{
+  char *role, *size, *save_ptr;
+  enum block_type type;
+
+  if (value == NULL)
+    PANIC ("-ramdisk requires an argument of the form ROLE:KB");
+  role = strtok_r (value, ":", &save_ptr);
+  size = strtok_r (NULL, "", &save_ptr);
+  if (role == NULL || size == NULL || atoi (size) <= 0)
+    PANIC ("-ramdisk requires an argument of the form ROLE:KB");
+
+  for (type = BLOCK_FILESYS; type < BLOCK_ROLE_CNT; type++)
+    if (!strcmp (role, block_type_name (type)))
+      break;
+  if (type == BLOCK_ROLE_CNT)
+    PANIC ("-ramdisk: unknown role `%s'", role);
+
+  ramdisk_role = type;
+  ramdisk_size_kb = atoi (size);
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices (void)
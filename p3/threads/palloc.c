@@ -148,6 +148,17 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Stores the address of the first page in the user pool into
+   *BASE and the number of pages in the pool into *PAGE_CNT.
+   The user pool never moves or changes size, so the frame table
+   can be an array indexed by a page's offset from *BASE. */
+void
+palloc_user_pool (void **base, size_t *page_cnt)
+{
+  *base = user_pool.base;
+  *page_cnt = bitmap_size (user_pool.used_map);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
@@ -0,0 +1,158 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* An object cache ("slab allocator").
+
+   malloc() rounds each request up to a power of 2 and shares
+   each size class among every kind of object of that size.  A
+   cache instead serves objects of one type only.  It gets pages,
+   called "slabs", from the page allocator, and packs as many
+   objects into each as fit after its header, so little of the
+   page goes to waste.
+
+   Each slab keeps its own list of free objects, and the cache
+   keeps a list of the slabs that have any, so allocating and
+   freeing take constant time.  A slab that has no objects in use
+   any longer is given back to the page allocator, unless it is
+   the only one with free objects left.
+
+   A cache may have a constructor.  It is applied to each object
+   when its slab is created, not each time the object is
+   allocated, so an object has to be back in its constructed
+   state (for example, any lock in it released) when it is freed.
+   The free list link is kept just past each object, not in it,
+   so that freeing an object does not disturb its contents. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+    size_t in_use;              /* Objects allocated. */
+    void *free;                 /* First free object. */
+  };
+
+static struct slab *new_slab (struct slab_cache *);
+static void **free_link (struct slab_cache *, void *obj);
+
+/* Initializes CACHE to hand out objects of SIZE bytes, applying
+   CTOR, if nonnull, to each one in a new slab.  NAME is for
+   debugging. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name, size_t size,
+                 void (*ctor) (void *))
+{
+  ASSERT (size > 0);
+
+  cache->name = name;
+  cache->obj_size = size;
+  cache->obj_stride = ROUND_UP (size, sizeof (void *)) + sizeof (void *);
+  cache->objs_per_slab = (PGSIZE - sizeof (struct slab)) / cache->obj_stride;
+  cache->ctor = ctor;
+  list_init (&cache->partial);
+  lock_init (&cache->lock);
+
+  ASSERT (cache->objs_per_slab > 0);
+}
+
+/* Obtains and returns an object from CACHE.  Returns a null
+   pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *cache)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&cache->lock);
+  if (list_empty (&cache->partial))
+    {
+      s = new_slab (cache);
+      if (s == NULL)
+        {
+          lock_release (&cache->lock);
+          return NULL;
+        }
+      list_push_front (&cache->partial, &s->elem);
+    }
+  else
+    s = list_entry (list_front (&cache->partial), struct slab, elem);
+
+  obj = s->free;
+  s->free = *free_link (cache, obj);
+  if (++s->in_use == cache->objs_per_slab)
+    list_remove (&s->elem);
+  lock_release (&cache->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  OBJ may be a null pointer. */
+void
+slab_free (struct slab_cache *cache, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == cache);
+
+  lock_acquire (&cache->lock);
+  *free_link (cache, obj) = s->free;
+  s->free = obj;
+  if (s->in_use-- == cache->objs_per_slab)
+    list_push_front (&cache->partial, &s->elem);
+  else if (s->in_use == 0
+           && list_begin (&cache->partial) != list_rbegin (&cache->partial))
+    {
+      list_remove (&s->elem);
+      s->magic = 0;
+      palloc_free_page (s);
+    }
+  lock_release (&cache->lock);
+}
+
+/* Gets a new slab for CACHE and constructs its objects.
+   Returns a null pointer if memory is not available. */
+static struct slab *
+new_slab (struct slab_cache *cache)
+{
+  struct slab *s = palloc_get_page (0);
+  uint8_t *obj;
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->in_use = 0;
+  s->free = NULL;
+  for (i = cache->objs_per_slab; i-- > 0; )
+    {
+      obj = (uint8_t *) (s + 1) + i * cache->obj_stride;
+      if (cache->ctor != NULL)
+        cache->ctor (obj);
+      *free_link (cache, obj) = s->free;
+      s->free = obj;
+    }
+  return s;
+}
+
+/* Returns the free list link of OBJ, an object in CACHE. */
+static void **
+free_link (struct slab_cache *cache, void *obj)
+{
+  return (void **) ((uint8_t *) obj + cache->obj_stride - sizeof (void *));
+}
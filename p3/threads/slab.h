@@ -0,0 +1,26 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Object cache.  Hands out objects of a single type, packed
+   into pages of their own, in constant time.  See slab.c. */
+struct slab_cache
+  {
+    const char *name;           /* For debugging. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t obj_stride;          /* Distance between objects in a slab. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    void (*ctor) (void *);      /* Constructor, or a null pointer. */
+    struct list partial;        /* Slabs with free objects. */
+    struct lock lock;           /* Lock. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      void (*ctor) (void *));
+void *slab_alloc (struct slab_cache *) __attribute__ ((malloc));
+void slab_free (struct slab_cache *, void *);
+
+#endif /* threads/slab.h */
@@ -182,6 +182,9 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+#ifdef VM
+  t->rss_limit = thread_current ()->rss_limit;
+#endif
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -478,6 +481,14 @@ init_thread (struct thread *t, const char *name, int priority)
 #ifdef VM
   list_init (&t->mmap_list);
   t->mmap_num = 0;
+  list_init (&t->vma_list);
+  t->swap_cluster = SIZE_MAX;
+  t->rss = 0;
+  t->rss_limit = 0;
+  list_init (&t->own_frames);
+  memset (&t->vmstat, 0, sizeof t->vmstat);
+  t->ws_fault_cnt = 0;
+  t->ws_over = false;
 #endif
 
   old_level = intr_disable ();
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "synch.h"
+#include <vmstat.h>
 #include "vm/page.h"
 
 /* States in a thread's life cycle. */
@@ -126,6 +127,16 @@ struct thread
     struct list mmap_list;              /* List of mmap file descriptors. */
     int mmap_num;                       /* Number of mmap files. */
     struct hash suppl_page_table;       /* The SPT which stores some information about a page */
+    struct list vma_list;               /* File-backed ranges, sorted by address */
+    size_t swap_cluster;                /* Swap cluster being filled, or SIZE_MAX */
+    struct vmstat vmstat;               /* Paging statistics */
+
+    /* Resident set, under frame_lock. */
+    size_t rss;                         /* Frames this process stands for */
+    size_t rss_limit;                   /* Most frames it may have, 0 if no limit */
+    struct list own_frames;             /* Frames it stands for, in clock order */
+    unsigned ws_fault_cnt;              /* vmstat.faults at the clock's last turn */
+    bool ws_over;                       /* More frames than its working set? */
 #endif
 
     /* Owned by thread.c. */
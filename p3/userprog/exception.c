@@ -16,6 +16,15 @@ static long long page_fault_cnt;
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Registers handlers for interrupts that can be caused by user
    programs.
 
@@ -146,7 +155,10 @@ page_fault (struct intr_frame *f)
    intr_enable ();
 
    /* Count page faults. */
+   uint64_t start = rdtsc ();
+   struct thread *cur = thread_current ();
    page_fault_cnt++;
+   cur->vmstat.faults++;
 
    /* Determine cause. */
    not_present = (f->error_code & PF_P) == 0;
@@ -155,31 +167,34 @@ page_fault (struct intr_frame *f)
    
    bool success = false;
 
-   /* if the fault is cause by user accessing an invalid address or read-only address, 
+   /* if the fault is cause by user accessing an invalid address, 
       exit(-1) instead of PANIC. --proj2 & proj3*/
-   if (fault_addr == NULL || (is_kernel_vaddr (fault_addr) && user) || !not_present)
+   if (fault_addr == NULL || (is_kernel_vaddr (fault_addr) && user))
       exit (-1);
 
-   struct suppl_page_table_entry *spte = page_hash_find (&thread_current ()->suppl_page_table, fault_addr);
+   struct suppl_page_table_entry *spte = page_lookup (fault_addr);
    
-   if (spte != NULL )
+   if (!not_present)
+   {
+      /* Writing a read-only page: fine if it is copy-on-write */
+      success = write && spte != NULL && page_cow (spte);
+   }
+   else if (spte != NULL )
    {
       /* If found, load the page */
-      if (spte->type == type_file || spte->type == type_mmap)
-         success = page_load_file (spte);
-      else if (spte->type == type_swap)
-         success = page_load_swap (spte);
+      success = page_load (spte, write);
    }
    else
    {
       /* If not found, try grow the stack if the fault address is valid */
       if ((fault_addr >= PHYS_BASE - STACK_LIMIT) && (fault_addr >= f->esp - 32))
-         success = stack_grow (fault_addr);
+         success = stack_grow (fault_addr, write);
    }
 
    /* Not handled */
    if (!success)
       exit (-1);
+   cur->vmstat.fault_cycles += rdtsc () - start;
 
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
@@ -156,6 +156,23 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Makes the page mapped at virtual page VPAGE in PD writable if
+   WRITABLE is true, read-only otherwise.  Does nothing if VPAGE
+   is not mapped. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL && (*pte & PTE_P) != 0) 
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
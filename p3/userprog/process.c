@@ -22,9 +22,19 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/mmap.h"
+#include "vm/swap.h"
+#include "vm/vma.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static struct child_status *child_status_create (void);
+static void add_child (tid_t tid, struct child_status *child);
+static bool fork_files (struct thread *parent, struct thread *child);
 static bool load (const char *file_name, void (**eip) (void), void **esp);
+
+/* Print each process's paging statistics when it exits?  Set
+   with the -vmstat kernel option. */
+bool process_print_vmstat;
 void free_child_list (struct thread * f);
 void free_opened_file (struct thread *f);
 
@@ -36,6 +46,7 @@ tid_t
 process_execute (const char *file_name) 
 {
   char *fn_copy;
+  struct child_status *child;
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
@@ -45,12 +56,21 @@ process_execute (const char *file_name)
     return TID_ERROR;
   strlcpy (fn_copy, file_name, PGSIZE);
 
+  /* Allocated up front: once the child runs, it is too late to fail */
+  child = child_status_create ();
+  if (child == NULL)
+  {
+    palloc_free_page (fn_copy);
+    return TID_ERROR;
+  }
+
   /* Extract the first arg - name of this thread */
   char *program_name, *save_ptr;
   program_name = palloc_get_page(0);  /* New mem, will be freed after thread_create() */
   if (program_name == NULL)
   {
     palloc_free_page (fn_copy);   /* If fail, free memory */
+    free (child);
     return TID_ERROR;
   }
   strlcpy (program_name, file_name, PGSIZE);
@@ -65,30 +85,162 @@ process_execute (const char *file_name)
   if (tid == TID_ERROR)
   {
     palloc_free_page (fn_copy);
+    free (child);
   }
   else
+    add_child (tid, child);
+  
+  return tid;
+}
+
+/* Allocates the status a child process reports to its parent.
+   Returns NULL if out of memory. */
+static struct child_status *
+child_status_create (void)
+{
+  struct child_status *child = malloc (sizeof (struct child_status)); /* New mem, will be freed in process_exit() */
+  if (child == NULL)
+    return NULL;
+
+  child->child_exit_code = 0;
+  child->child_waited = false;
+  sema_init (&child->child_wait_sema, 0);  /* Note that initial sema is 0 */
+  return child;
+}
+
+/* Records thread TID, just created, as a child of the current
+   process, with status CHILD from child_status_create(). */
+static void
+add_child (tid_t tid, struct child_status *child)
+{
+  /* Setup initial infomation for the child thread */
+  struct thread* new_thread = thread_get_by_tid(tid);
+  new_thread->parent_tid = thread_current ()->tid;
+
+  child->child_tid = tid;
+  list_push_back (&thread_current ()->child_thread_list, &child->child_elem);
+}
+
+/* What a forked child needs from its parent to start. */
+struct fork_info
+{
+  struct thread *parent;        /* The forking process */
+  struct intr_frame if_;        /* Its user context at the fork() call */
+};
+
+/* Starts a new thread running a copy of the current process, which
+   resumes from the system call whose interrupt frame is F.  Like
+   process_execute(), the new process reports whether it could be
+   set up through the current thread's load_sema and load_state.
+   Returns the new process's thread id, or TID_ERROR if the thread
+   cannot be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  struct child_status *child;
+  tid_t tid;
+
+  /* Allocated up front, so that a child that starts running is
+     always one its parent can wait for */
+  child = child_status_create ();
+  if (child == NULL)
+    return TID_ERROR;
+
+  /* INFO can live on our stack: the caller waits on load_sema
+     until the child is done with it. */
+  info.parent = thread_current ();
+  info.if_ = *f;
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork, &info);
+  if (tid == TID_ERROR)
+    free (child);
+  else
+    add_child (tid, child);
+  return tid;
+}
+
+/* A thread function that copies its parent's address space and
+   open files, then returns to user mode where the parent's
+   fork() call left off, with 0 as the return value. */
+static void
+start_fork (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = info->parent;
+  struct intr_frame if_ = info->if_;
+  bool success;
+
+  spte_init(&cur->suppl_page_table);
+
+  cur->pagedir = pagedir_create ();
+  process_activate ();
+  success = (cur->pagedir != NULL
+             && fork_files (parent, cur)
+             && page_fork (parent, cur));
+
+  if (success)
+    parent->load_state = LOAD_SUCCESS;
+  else
+    parent->load_state = LOAD_FAIL;
+  sema_up (&parent->load_sema);
+
+  if (!success)
   {
-    /* Setup initial infomation for the child thread */
-    struct thread* new_thread = thread_get_by_tid(tid);
-    new_thread->parent_tid = thread_current ()->tid;
-    
-    struct child_status *child = malloc (sizeof (struct child_status)); /* New mem, will be freed in process_exit() */
-    if (child != NULL)
-    { 
-      child->child_tid = tid;
-      child->child_exit_code = 0;
-      child->child_waited = false;
-      sema_init (&child->child_wait_sema, 0);  /* Note that initial sema is 0 */
-      list_push_back (&thread_current ()->child_thread_list, &child->child_elem);
-    }
+    cur->exit_code = -1;
+    thread_exit ();
+  }
+
+  /* Return 0 from fork() in the child */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives CHILD its own copy of PARENT's executable and of each of
+   its file descriptors, at the same file position.  Returns false
+   if out of memory. */
+static bool
+fork_files (struct thread *parent, struct thread *child)
+{
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire (&file_lock);
+  if (parent->running_file != NULL)
+  {
+    child->running_file = file_reopen (parent->running_file);
+    if (child->running_file == NULL)
+      success = false;
     else
+      file_deny_write (child->running_file);
+  }
+
+  for (e = list_begin (&parent->fd_list); success && e != list_end (&parent->fd_list);
+       e = list_next (e))
+  {
+    struct file_descriptor *pfd = list_entry (e, struct file_descriptor, elem);
+    struct file_descriptor *cfd = malloc (sizeof (struct file_descriptor));
+    if (cfd == NULL)
+    {
+      success = false;
+      break;
+    }
+    cfd->fd = pfd->fd;
+    cfd->file = file_reopen (pfd->file);
+    if (cfd->file == NULL)
     {
-      palloc_free_page (fn_copy);
-      return TID_ERROR;
+      free (cfd);
+      success = false;
+      break;
     }
+    file_seek (cfd->file, file_tell (pfd->file));
+    list_push_back (&child->fd_list, &cfd->elem);
   }
-  
-  return tid;
+  child->file_num = parent->file_num;
+  lock_release (&file_lock);
+
+  return success;
 }
 
 /* A thread function that loads a user process and starts it
@@ -196,6 +348,15 @@ process_exit (void)
   uint32_t *pd;
 
   printf("%s: exit(%d)\n", cur->name, cur->exit_code);
+  if (process_print_vmstat)
+  {
+    struct vmstat *s = &cur->vmstat;
+    printf ("%s: %u page faults (%u file, %u cached, %u swap, %u stack, "
+            "%u zero, %u cow), %u evictions, %llu cycles\n",
+            cur->name, s->faults, s->file_faults, s->cached_faults,
+            s->swap_faults, s->stack_faults, s->zero_faults, s->cow_faults,
+            s->evictions, s->fault_cycles);
+  }
 
   struct thread *parent_thread = thread_get_by_tid(cur->parent_tid);
   if (parent_thread)
@@ -239,10 +400,12 @@ process_exit (void)
 
   /* Free mmap list */
   free_mmap_list (&cur->mmap_list);
+  /* Free all frames */
+  vm_clear_process_frame_table (cur);
   /* Free the supplementary page table. */
   free_suppl_page_table (&cur->suppl_page_table);
-  /* Free all frames */
-  vm_clear_process_frame_table (cur->tid);
+  free_vma_list (&cur->vma_list);
+  swap_release_cluster (cur);
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -556,7 +719,7 @@ setup_stack (void **esp, char *file_name)
 {
   bool success = false;
 
-  success = stack_grow (((uint8_t *) PHYS_BASE) - PGSIZE);
+  success = stack_grow (((uint8_t *) PHYS_BASE) - PGSIZE, true);
   if (success)
     *esp = PHYS_BASE;
 
@@ -3,13 +3,18 @@
 
 #include "threads/thread.h"
 
+struct intr_frame;
+
 typedef int tid_t;
 
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
 bool install_page (void *upage, void *kpage, bool writable);
 
+extern bool process_print_vmstat;
+
 #endif /* userprog/process.h */
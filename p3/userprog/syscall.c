@@ -16,12 +16,20 @@
 #include "vm/page.h"
 #include "vm/mmap.h"
 
+/* Most bytes of a user buffer that read() and write() pin at once.
+   Larger buffers are transferred a chunk at a time, so that a
+   process never holds more than PIN_CHUNK / PGSIZE + 1 frames
+   pinned, however large its buffer. */
+#define PIN_CHUNK (8 * PGSIZE)
+
 static const struct intr_frame *global_f;
 
 static void syscall_handler (struct intr_frame *);
 static struct file_descriptor *getfile (struct thread *t, int fd);
-static void check_read_buffer (void *buffer, unsigned size);
-static void read_buf_page_fault_handler (void *fault_addr);
+static struct mmap_entry *getmmap (struct thread *t, mapid_t mapping);
+static pid_t sys_fork (const struct intr_frame *f);
+static void pin_buffer (const void *buffer, unsigned size, bool write);
+static void unpin_buffer (const void *buffer, unsigned size);
 
 void
 syscall_init (void) 
@@ -211,6 +219,43 @@ syscall_handler (struct intr_frame *f)
       munmap(mapping);
       break;
     }
+    case SYS_FORK:
+    {
+      f->eax = (uint32_t) sys_fork (f);
+      break;
+    }
+    case SYS_MSYNC:
+    {
+      if (!validate_addr((void *) (esp + 1))
+      || !validate_addr((void *) (esp + 2)))
+      {
+        exit(-1);
+      }
+      mapid_t mapping = *(esp + 1);
+      int flags = *(esp + 2);
+      f->eax = (uint32_t) msync (mapping, flags);
+      break;
+    }
+    case SYS_SET_RSS_LIMIT:
+    {
+      if (!validate_addr((void *) (esp + 1)))
+      {
+        exit(-1);
+      }
+      unsigned pages = *(esp + 1);
+      set_rss_limit (pages);
+      break;
+    }
+    case SYS_VMSTAT:
+    {
+      if (!validate_addr((void *) (esp + 1)))
+      {
+        exit(-1);
+      }
+      struct vmstat *stats = (struct vmstat *) *(esp + 1);
+      f->eax = (uint32_t) vmstat (stats);
+      break;
+    }
 
     default:
       break;
@@ -365,30 +410,39 @@ read (int fd, void *buffer, unsigned length){
   if (fd == 1)
     return -1;
   
-  check_read_buffer (buffer, length);
-
-  // if(!validate_addr((void *) buffer)){
-  //   exit(-1);
-  // }
-  
   int size = 0;
   struct file_descriptor *file_desc = getfile (thread_current(), fd);
 
-  if (fd == 0)
-  {
-    uint8_t *buf = buffer;
-    for (unsigned int i = 0; i < length; i++)
-      buf[i] = input_getc ();
-    return length;
-  }
-  
-  if (file_desc == NULL || file_desc->file == NULL)
+  if (fd != 0 && (file_desc == NULL || file_desc->file == NULL))
     return -1;
 
-  lock_acquire (&file_lock);
-  size = file_read (file_desc->file, buffer, length);
-  lock_release (&file_lock);
-  return size;
+  /* A chunk at a time, down to a short read */
+  unsigned ofs = 0;
+  do
+  {
+    uint8_t *buf = (uint8_t *) buffer + ofs;
+    unsigned chunk = length - ofs < PIN_CHUNK ? length - ofs : PIN_CHUNK;
+
+    pin_buffer (buf, chunk, true);
+    if (fd == 0)
+    {
+      for (unsigned int i = 0; i < chunk; i++)
+        buf[i] = input_getc ();
+      size = chunk;
+    }
+    else
+    {
+      lock_acquire (&file_lock);
+      size = file_read (file_desc->file, buf, chunk);
+      lock_release (&file_lock);
+    }
+    unpin_buffer (buf, chunk);
+    ofs += size;
+    if ((unsigned) size < chunk)
+      break;
+  }
+  while (ofs < length);
+  return ofs;
 }
 
 /* Writes size bytes from buffer to the open file fd. 
@@ -400,26 +454,38 @@ write (int fd, const void *buffer, unsigned length){
   if (fd == 0)
     return -1;
 
-  if(!validate_addr((void *) buffer)){
-    exit(-1);
-  }
   int size = 0 ;
-
-  
-  if (fd == 1)
-  { 
-    putbuf ((char *)buffer, (size_t)length);
-    return length;
-  }
   struct file_descriptor* file_desc = getfile (thread_current(), fd);
-  if (file_desc == NULL || file_desc->file == NULL)
+
+  if (fd != 1 && (file_desc == NULL || file_desc->file == NULL))
     return -1;
-  
-  lock_acquire (&file_lock);
-  size = file_write (file_desc->file, buffer, length);
-  lock_release (&file_lock);
-  
-  return size;
+
+  /* A chunk at a time, down to a short write */
+  unsigned ofs = 0;
+  do
+  {
+    const uint8_t *buf = (const uint8_t *) buffer + ofs;
+    unsigned chunk = length - ofs < PIN_CHUNK ? length - ofs : PIN_CHUNK;
+
+    pin_buffer (buf, chunk, false);
+    if (fd == 1)
+    { 
+      putbuf ((char *)buf, (size_t)chunk);
+      size = chunk;
+    }
+    else
+    {
+      lock_acquire (&file_lock);
+      size = file_write (file_desc->file, buf, chunk);
+      lock_release (&file_lock);
+    }
+    unpin_buffer (buf, chunk);
+    ofs += size;
+    if ((unsigned) size < chunk)
+      break;
+  }
+  while (ofs < length);
+  return ofs;
 }
 
 /* Changes the next byte to be read or written in open 
@@ -492,7 +558,8 @@ mmap(int fd, void* addr){
   if (f == NULL)
     return -1;
   
-  /* Check if addr overlaps any mapped pages. */
+  /* Check if addr overlaps the stack.  page_lazy_load() checks
+     for overlap with code, data and other mappings. */
   off_t offset;
   for (offset = 0; offset < read_bytes; offset += PGSIZE)
   {
@@ -501,18 +568,22 @@ mmap(int fd, void* addr){
       return -1;
   }
   
-  struct mmap_entry* mmap_entry = malloc (sizeof (struct mmap_entry));
-  if (mmap_entry == NULL)
-    return -1;
-  
   uint32_t zero_bytes = offset - read_bytes;
+  struct mmap_entry* mmap_entry = mmap_entry_alloc ();
+  if (mmap_entry == NULL
+      || !page_lazy_load (f, 0, addr, read_bytes, zero_bytes, true, type_mmap))
+  {
+    mmap_entry_free (mmap_entry);
+    lock_acquire (&file_lock);
+    file_close (f);
+    lock_release (&file_lock);
+    return -1;
+  }
+
   mmap_entry->mmap_id = current_thread->mmap_num++;
   mmap_entry->uvaddr = addr;
   mmap_entry->page_num = offset / PGSIZE;
   mmap_entry->file = f;
-  if (!page_lazy_load (f, 0, addr, read_bytes, zero_bytes, true, type_mmap))
-    return -1;
-  
   list_push_back (&current_thread->mmap_list, &mmap_entry->elem);
   mapid_t result = mmap_entry->mmap_id;
   return result;
@@ -520,26 +591,96 @@ mmap(int fd, void* addr){
 
 void
 munmap(mapid_t mapping){
-  struct thread *t = thread_current ();
-  struct list_elem *e = list_begin (&t->mmap_list);
-  struct list_elem *next;
-  /* Iterate the mmap_list and free all the related resources then delete it from the mmap_list */
-  while (e != list_end (&t->mmap_list))
+  struct mmap_entry *entry = getmmap (thread_current (), mapping);
+
+  /* Free all the related resources then delete it from the mmap_list */
+  if (entry != NULL)
   {
-    next = list_next (e);
-    struct mmap_entry *entry = list_entry (e, struct mmap_entry, elem);
-    if (entry->mmap_id == mapping)
-    {
-      free_mmap_entry (entry);
-      list_remove (e);
-      free (entry);
-      break;
-    }
-    e = next;
+    free_mmap_entry (entry);
+    list_remove (&entry->elem);
+    mmap_entry_free (entry);
   }
 }
 
 
+/*---------------------------- extensions ----------------------------*/
+
+/* Creates a new process, the child, that is a copy of the current
+   one, the parent.  The child's memory starts out shared with the
+   parent's, and a page is copied only when either process first
+   writes to it.  The child gets its own copy of each of the
+   parent's file descriptors, at the same position, but no memory
+   mappings.  The child resumes from interrupt frame F, this
+   process's own frame for the system call.  Returns the child's pid
+   in the parent and 0 in the child, or -1 if the child cannot be
+   created. */
+static pid_t
+sys_fork (const struct intr_frame *f)
+{
+  pid_t pid = process_fork (f);
+  if (pid == TID_ERROR)
+    return -1;
+
+  struct thread *cur = thread_current ();
+  sema_down (&cur->load_sema);
+
+  if (cur->load_state == LOAD_SUCCESS)
+    return pid;
+  else
+    return -1;
+}
+
+/* Writes the pages of MAPPING that were modified since they were
+   last written back to the mapped file.  With MS_SYNC, writes
+   them before returning.  With MS_ASYNC, leaves them to the
+   write-back daemon, which gets to them within a few seconds.
+   MS_INVALIDATE is accepted but has nothing to do, as the mapping
+   is the only copy of the file's data in memory.  Returns false
+   if MAPPING is not a mapping of this process or FLAGS is not
+   exactly one of MS_SYNC and MS_ASYNC, plus optionally
+   MS_INVALIDATE. */
+bool
+msync (mapid_t mapping, int flags)
+{
+  struct mmap_entry *entry = getmmap (thread_current (), mapping);
+  int mode = flags & (MS_ASYNC | MS_SYNC);
+
+  if (entry == NULL || (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0
+      || (mode != MS_ASYNC && mode != MS_SYNC))
+    return false;
+
+  if (mode == MS_SYNC)
+    sync_mmap_entry (entry);
+  return true;
+}
+
+
+/* Limits the current process, and the processes it creates from
+   now on, to PAGES frames of memory, or lifts the limit if PAGES
+   is 0.  A process at its limit makes room for a page it faults
+   in by evicting one of its own; the clock also takes frames
+   first from processes over their limit.  Frames shared with
+   other processes count only against the process they were
+   first loaded or forked by. */
+void
+set_rss_limit (unsigned pages)
+{
+  thread_current ()->rss_limit = pages;
+}
+
+
+/* Copies the current process's paging statistics into STATS.
+   Returns true. */
+bool
+vmstat (struct vmstat *stats)
+{
+  pin_buffer (stats, sizeof *stats, true);
+  *stats = thread_current ()->vmstat;
+  unpin_buffer (stats, sizeof *stats);
+  return true;
+}
+
+
 /*------------------------- Helper functions -------------------------*/
 /* Return the file by given fd in the given thread */
 struct file_descriptor*
@@ -557,6 +698,21 @@ getfile (struct thread *t, int fd)
   return NULL;
 }
 
+/* Return the memory mapping with id MAPPING in the given thread */
+struct mmap_entry *
+getmmap (struct thread *t, mapid_t mapping)
+{
+  struct list_elem *e;
+  for (e = list_begin (&t->mmap_list); e != list_end (&t->mmap_list);
+       e = list_next (e))
+  {
+    struct mmap_entry *entry = list_entry (e, struct mmap_entry, elem);
+    if (entry->mmap_id == mapping)
+      return entry;
+  }
+  return NULL;
+}
+
 bool validate_addr(void *ptr)
 {
   if (ptr == NULL)
@@ -593,68 +749,58 @@ bool validate_string (char *str)
   return false;
 }
 
+/* Brings the pages of the user buffer of SIZE bytes at BUFFER
+   into memory and pins them there, so that the system call can
+   access it, with file_lock held, without faulting.  If WRITE is
+   true, the call writes to the buffer, so it must be writable.
+   Grows the stack if the buffer extends below it, as a fault there
+   would.  Exits the process if the buffer is not valid.  Every
+   pin_buffer() must be followed by unpin_buffer() with the same
+   arguments once the call is done with the buffer.  Pinned frames
+   cannot be evicted, so callers pin at most PIN_CHUNK bytes at a
+   time. */
 static void
-check_read_buffer (void *buffer, unsigned length)
+pin_buffer (const void *buffer, unsigned size, bool write)
 {
-  void *buf_iter = buffer;
-  if (length < PGSIZE)
+  struct thread *cur = thread_current ();
+  uint8_t *start = pg_round_down (buffer);
+  uint8_t *end = (uint8_t *) buffer + (size > 0 ? size : 1);
+  uint8_t *upage;
+
+  if (buffer == NULL || end < (uint8_t *) buffer || !is_user_vaddr (end - 1))
+    exit (-1);
+
+  for (upage = start; upage < end; upage += PGSIZE)
   {
-    /* If the read length is less than PGSIZE, 
-       just check the boundaries within the buffer */
-    read_buf_page_fault_handler (buf_iter);
-    read_buf_page_fault_handler (buf_iter + length);
-  }
-  else
-  { 
-    /* If the read length is larger/equal than PGSIZE, 
-       check each possible page boundaries */
-    buf_iter = pg_round_down (buf_iter);
-    unsigned page_count = 0;
-    if (length % PGSIZE == 0)
-      page_count = length / PGSIZE;
-    else
-      page_count = length / PGSIZE + 1;
-    
-    for (int i = 0; i <= page_count; i++)
+    void *addr = upage == start ? (void *) buffer : upage;
+
+    if (page_pin (addr, write))
+      continue;
+
+    /* Not part of the address space: may be stack yet to grow */
+    if (page_lookup (addr) == NULL
+        && addr >= PHYS_BASE - STACK_LIMIT
+        && addr >= global_f->esp - 32)
     {
-      read_buf_page_fault_handler (buf_iter);
-      buf_iter += PGSIZE;
+      cur->vmstat.faults++;
+      if (stack_grow (addr, write) && page_pin (addr, write))
+        continue;
     }
+
+    /* Undo the pins taken so far */
+    if (upage > start)
+      unpin_buffer (buffer, upage - (uint8_t *) buffer);
+    exit (-1);
   }
 }
 
+/* Unpins the pages of the user buffer that pin_buffer() pinned. */
 static void
-read_buf_page_fault_handler (void *fault_addr)
+unpin_buffer (const void *buffer, unsigned size)
 {
-  if (fault_addr == NULL || !is_user_vaddr (fault_addr))
-    exit (-1);
-
-  struct thread *cur = thread_current ();
-  bool success = false;
+  uint8_t *end = (uint8_t *) buffer + (size > 0 ? size : 1);
+  uint8_t *upage;
 
-  /* Check if the addr is mapped to kernal addr */
-  if (pagedir_get_page (cur->pagedir, fault_addr) == NULL)
-  {
-    /* If not mapped, handle it, try find and load */
-    struct suppl_page_table_entry *spte;
-    spte = page_hash_find (&cur->suppl_page_table, fault_addr);
-    if (spte != NULL)
-    {
-      if (spte->type == type_file || spte->type == type_mmap)
-      {
-        success = page_load_file (spte);
-      }
-      else if (spte->type == type_swap)
-      {
-        success = page_load_swap (spte);
-      }
-    }
-    else if (fault_addr >= global_f->esp - 32)
-      success = stack_grow (fault_addr);
-    
-    if (!success)
-      exit (-1);
-  }
-  else
-    return;     /* If mapped, do nothing */
+  for (upage = pg_round_down (buffer); upage < end; upage += PGSIZE)
+    page_unpin (upage);
 }
@@ -33,4 +33,9 @@ void close (int fd);
 mapid_t mmap(int fd, void* addr);
 void munmap(mapid_t mapping);
 
+/* Extensions */
+bool msync (mapid_t mapping, int flags);
+void set_rss_limit (unsigned pages);
+bool vmstat (struct vmstat *);
+
 #endif /* userprog/syscall.h */
\ No newline at end of file
@@ -1,50 +1,210 @@
-#include <list.h>
+#include <round.h>
 #include <string.h>
+#include "filesys/inode.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
-#include "threads/malloc.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "swap.h"
 #include "frame.h"
 
 
-void *find_unaccessed_page (struct suppl_page_table_entry *);
-void *find_longest_time_page (struct suppl_page_table_entry *);
+static struct frame_tab_entry *clock_select (struct thread *);
+static bool clock_try (struct frame_tab_entry *, bool favored);
+static bool spte_try_lock (struct suppl_page_table_entry *);
+static void clock_turned (struct thread *, void *);
+static void *get_frame (enum palloc_flags, void *, bool may_evict);
+static void pageout_daemon (void *);
+static void flush_daemon (void *);
+static void flush_frames (size_t start, size_t cnt);
+static void flush_batch (struct frame_tab_entry **, size_t);
+static unsigned cache_hash (const struct hash_elem *, void *);
+static bool cache_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
+static void uncache (struct frame_tab_entry *);
+static void share_frame (struct frame_tab_entry *, struct frame_mapping *);
+static bool lock_sharers (struct frame_tab_entry *);
+static void unmap_shared (struct frame_tab_entry *, struct thread *,
+                          struct suppl_page_table_entry *);
+
+/* Frame table, one entry per page of the user pool, so the entry
+   for a frame is found by arithmetic rather than by a search and
+   no entry is ever allocated or freed after boot. */
+static struct frame_tab_entry *frame_table;
+static size_t frame_cnt;          /* Number of entries in frame_table */
+static uint8_t *user_base;        /* Frame of frame_table[0] */
+static size_t clock_hand;         /* Next entry the clock examines */
+static size_t used_cnt;           /* Frames allocated from the user pool */
 
 struct lock frame_lock;
 
+/* Page cache: the frames holding read-only file pages, keyed on
+   (inode, offset), so that processes running the same executable
+   share its code instead of each reading its own copy.  A cached
+   frame lists every process that maps it, so that eviction can
+   unmap it from all of them.  It leaves the cache when it is
+   evicted or its last process exits.  Protected by frame_lock. */
+static struct hash page_cache;
+
+/* A page of zeros, from the kernel pool, that every process maps
+   read-only in place of each page it has read but never written
+   that holds only zeros: BSS, and stack below the stack pointer.
+   The first write to such a page gives it a frame of its own (see
+   vm_cow_frame()).  It has no frame table entry and is never
+   evicted. */
+static void *zero_page;
+
+/* Where frame_mappings come from.  Sharing a frame allocates one
+   per process that maps it, on the fault and fork paths. */
+static struct slab_cache mapping_cache;
+
+/* Free frame watermarks.  When a fault leaves fewer than
+   low_water frames free, the pageout daemon wakes up and evicts
+   pages until high_water frames are free, so that most faults
+   find a free frame without evicting anything themselves. */
+static size_t low_water, high_water;
+static struct semaphore pageout_sema;  /* Upped to wake the daemon */
+static bool pageout_running;           /* Daemon awake? */
+
+/* Frames ahead of the clock hand that the daemon looks at for
+   dirty mmap pages to write back early. */
+#define PRECLEAN_SCAN 16
+
+/* Ticks between runs of the write-back daemon, and most pages it
+   writes back at a time. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define FLUSH_BATCH 16
+
+/* A process that takes fewer page faults than this over a turn
+   of the clock is taken to hold more than its working set. */
+#define WS_FAULTS 1
+
+/* Allocates the frame table, sized to the user pool, from the
+   kernel pool.  Must be called after palloc_init(). */
 void 
 vm_frame_table_init (void)
 {
-  list_init (&frame_table);
+  size_t i;
+
+  palloc_user_pool ((void **) &user_base, &frame_cnt);
+  frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                     DIV_ROUND_UP (frame_cnt
+                                                   * sizeof *frame_table,
+                                                   PGSIZE));
+  for (i = 0; i < frame_cnt; i++)
+    frame_table[i].frame = user_base + i * PGSIZE;
   lock_init (&frame_lock);
+  hash_init (&page_cache, cache_hash, cache_less, NULL);
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  slab_cache_init (&mapping_cache, "frame_mapping",
+                   sizeof (struct frame_mapping), NULL);
+
+  low_water = frame_cnt / 32 > 2 ? frame_cnt / 32 : 2;
+  high_water = 2 * low_water;
+  sema_init (&pageout_sema, 0);
 }
 
+/* Starts the pageout and write-back daemons.  Must be called
+   after swap_init(). */
+void
+vm_pageout_init (void)
+{
+  thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+  thread_create ("flush", PRI_DEFAULT, flush_daemon, NULL);
+}
+
+/* Returns the frame table entry for FRAME, a page in the user pool */
+static struct frame_tab_entry *
+frame_to_entry (void *frame)
+{
+  size_t idx = ((uint8_t *) frame - user_base) / PGSIZE;
+
+  ASSERT (pg_ofs (frame) == 0);
+  ASSERT (idx < frame_cnt);
+  return &frame_table[idx];
+}
+
+/* Returns a frame for SPTE's page, evicting another page if no
+   frame is free, or NULL if that fails. */
 void *
 vm_get_frame (enum palloc_flags flags, void *spte)
 {
+  return get_frame (flags, spte, true);
+}
+
+/* Returns a free frame for SPTE's page, or NULL if none is free.
+   For optional work, such as reading ahead, that is not worth
+   evicting a page for. */
+void *
+vm_try_get_frame (void *spte)
+{
+  return get_frame (PAL_USER, spte, false);
+}
+
+/* Implements vm_get_frame() and vm_try_get_frame(). */
+static void *
+get_frame (enum palloc_flags flags, void *spte, bool may_evict)
+{
+  struct thread *cur = thread_current ();
+  struct frame_tab_entry *own = NULL;
+  void *frame = NULL;
+
   if (!(flags & PAL_USER))
     return NULL;
   
+  /* A process at its RSS limit replaces one of its own pages, if
+     it can find one to replace, rather than take a free frame */
+  bool at_limit = cur->rss_limit != 0 && cur->rss >= cur->rss_limit;
+  if (at_limit && !may_evict)
+    return NULL;
+
   /* Get a frame from memory */
-  void *frame = palloc_get_page (flags);
+  if (!at_limit)
+    frame = palloc_get_page (flags);
+  if (frame == NULL && !may_evict)
+    return NULL;
 
-  /* Evict a frame if no frame can be get */
-  if (frame == NULL)
-    return try_evict_frame ((struct suppl_page_table_entry *) spte);
+  lock_acquire (&frame_lock);
+  if (at_limit)
+    own = clock_select (cur);
+  if (own != NULL)
+    frame = do_evict_frame (own);
+  else if (at_limit)
+    frame = palloc_get_page (flags);
+  if (frame != NULL && own == NULL)
+    used_cnt++;
+  else if (frame == NULL)
+  {
+    /* The daemon has fallen behind: evict a frame ourselves */
+    frame = try_evict_frame ();
+    if (frame == NULL)
+    {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+  }
 
-  /* Create a ft_entry */
-  struct frame_tab_entry *ft_entry = malloc (sizeof (struct frame_tab_entry));
-  if (ft_entry == NULL)
-    return NULL;
-  
+  /* Fill in its ft_entry */
+  struct frame_tab_entry *ft_entry = frame_to_entry (frame);
   ft_entry->spte = (struct suppl_page_table_entry *) spte;
-  ft_entry->frame = frame;
-  ft_entry->owner = thread_tid();
+  ft_entry->owner = cur;
+  cur->rss++;
+  list_push_back (&cur->own_frames, &ft_entry->own_elem);
+  ft_entry->evicting = false;
+  ft_entry->pin_cnt = 0;
+  ft_entry->shared = false;
+  ft_entry->cached = false;
 
-  lock_acquire (&frame_lock);
-  list_push_front (&frame_table, &ft_entry->elem);
+  /* Wake the daemon if free frames are running low */
+  if (frame_cnt - used_cnt < low_water && !pageout_running)
+  {
+    pageout_running = true;
+    sema_up (&pageout_sema);
+  }
   lock_release (&frame_lock);
   return frame;
 }
@@ -54,181 +214,948 @@ vm_free_frame (void *frame)
 {
   if (frame != NULL)
   {
-    struct list_elem *e = list_begin (&frame_table);
-    struct list_elem *next;
-    struct frame_tab_entry *ft_entry;
+    struct frame_tab_entry *ft_entry = frame_to_entry (frame);
 
     lock_acquire (&frame_lock);
-    while (e != list_end (&frame_table))
+    ft_entry->spte = NULL;
+    ft_entry->owner->rss--;
+    list_remove (&ft_entry->own_elem);
+    used_cnt--;
+    palloc_free_page (frame);
+    lock_release (&frame_lock);
+  }
+}
+
+/* Clears the entries for the frames holding T's pages, which T's
+   page directory still maps.  The frames themselves are freed
+   when the page directory is destroyed.  Must be called before
+   T's supplementary page table is freed. */
+void
+vm_clear_process_frame_table (struct thread *t)
+{
+  struct hash_iterator i;
+
+  if (t->pagedir == NULL)
+    return;
+
+  lock_acquire (&frame_lock);
+  hash_first (&i, &t->suppl_page_table);
+  while (hash_next (&i))
+  {
+    struct suppl_page_table_entry *spte
+      = hash_entry (hash_cur (&i), struct suppl_page_table_entry, hash_elem);
+    void *frame = pagedir_get_page (t->pagedir, spte->addr);
+
+    if (frame == NULL)
+      continue;
+    /* Keep pagedir_destroy() from freeing the zero page */
+    if (frame == zero_page)
+      pagedir_clear_page (t->pagedir, spte->addr);
+    else if (frame_to_entry (frame)->shared)
+      unmap_shared (frame_to_entry (frame), t, spte);
+    /* Just clear entries */
+    else if (frame_to_entry (frame)->spte == spte)
     {
-      next = list_next (e);
-      ft_entry = list_entry (e, struct frame_tab_entry, elem);
+      frame_to_entry (frame)->spte = NULL;
+      t->rss--;
+      list_remove (&frame_to_entry (frame)->own_elem);
+      used_cnt--;
+    }
+  }
+  lock_release (&frame_lock);
+}
 
-      /* Found the correponding entry, remove it */
-      if (ft_entry->frame == frame)
-      {
-        list_remove (e);
-        free (ft_entry);
-        palloc_free_page (frame);
-        break;
-      }
-      e = next;
+/* Returns a hash value for the page in cached frame E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame_tab_entry *f
+    = hash_entry (e, struct frame_tab_entry, cache_elem);
+  return hash_int (f->sector) ^ hash_int (f->offset);
+}
+
+/* Orders cached frames A and B by (inode, offset). */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame_tab_entry *a
+    = hash_entry (a_, struct frame_tab_entry, cache_elem);
+  const struct frame_tab_entry *b
+    = hash_entry (b_, struct frame_tab_entry, cache_elem);
+
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  return a->offset < b->offset;
+}
+
+/* Returns the cached frame holding SPTE's page, or NULL. */
+static struct frame_tab_entry *
+cache_find (struct suppl_page_table_entry *spte)
+{
+  struct frame_tab_entry tmp;
+  struct hash_elem *e;
+
+  tmp.sector = inode_get_inumber (file_get_inode (spte->file));
+  tmp.offset = spte->offset;
+  e = hash_find (&page_cache, &tmp.cache_elem);
+  return e != NULL ? hash_entry (e, struct frame_tab_entry, cache_elem) : NULL;
+}
+
+/* Maps SPTE's page, a read-only file page of the current process,
+   to the frame that already holds it in the page cache, if any.
+   Returns true if successful, false if the caller has to read the
+   page itself.  Caller must hold SPTE's lock. */
+bool
+vm_map_cached_frame (struct suppl_page_table_entry *spte)
+{
+  struct frame_tab_entry *f_entry;
+  struct frame_mapping *m;
+  bool success = false;
+
+  m = slab_alloc (&mapping_cache);
+  if (m == NULL)
+    return false;
+
+  lock_acquire (&frame_lock);
+  f_entry = cache_find (spte);
+  if (f_entry != NULL && !f_entry->evicting
+      && f_entry->spte->read_bytes == spte->read_bytes
+      && install_page (spte->addr, f_entry->frame, false))
+  {
+    m->owner = thread_current ();
+    m->spte = spte;
+    list_push_back (&f_entry->mappings, &m->elem);
+    success = true;
+  }
+  lock_release (&frame_lock);
+
+  if (!success)
+    slab_free (&mapping_cache, m);
+  return success;
+}
+
+/* Enters FRAME, which holds SPTE's page, a read-only file page
+   just read in and mapped by the current process, into the page
+   cache for other processes to share.  If the page cache already
+   has a frame for the page, FRAME stays private. */
+void
+vm_cache_frame (void *frame, struct suppl_page_table_entry *spte)
+{
+  struct frame_tab_entry *f_entry = frame_to_entry (frame);
+  struct frame_mapping *m;
+
+  ASSERT (f_entry->spte == spte);
+
+  m = slab_alloc (&mapping_cache);
+  if (m == NULL)
+    return;
+
+  lock_acquire (&frame_lock);
+  if (cache_find (spte) == NULL)
+  {
+    f_entry->cached = true;
+    f_entry->sector = inode_get_inumber (file_get_inode (spte->file));
+    f_entry->offset = spte->offset;
+    share_frame (f_entry, m);
+    hash_insert (&page_cache, &f_entry->cache_elem);
+    m = NULL;
+  }
+  lock_release (&frame_lock);
+  slab_free (&mapping_cache, m);
+}
+
+/* Makes F_ENTRY, a private frame, shared, with M as the mapping
+   of the process that maps it now. */
+static void
+share_frame (struct frame_tab_entry *f_entry, struct frame_mapping *m)
+{
+  ASSERT (!f_entry->shared);
+
+  m->owner = f_entry->owner;
+  m->spte = f_entry->spte;
+  list_init (&f_entry->mappings);
+  list_push_back (&f_entry->mappings, &m->elem);
+  f_entry->shared = true;
+}
+
+/* Removes T's mapping, of SPTE's page, from shared frame F_ENTRY,
+   and unmaps it from T.  Frees the frame if no process maps it
+   any longer.  A copy-on-write frame left with a single process
+   becomes private to it again.  Must be called with frame_lock
+   held. */
+static void
+unmap_shared (struct frame_tab_entry *f_entry, struct thread *t,
+              struct suppl_page_table_entry *spte)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (e = list_begin (&f_entry->mappings); e != list_end (&f_entry->mappings);
+       e = list_next (e))
+  {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    if (m->owner == t && m->spte == spte)
+    {
+      list_remove (e);
+      slab_free (&mapping_cache, m);
+      break;
+    }
+  }
+
+  pagedir_clear_page (t->pagedir, spte->addr);
+  f_entry->owner->rss--;
+  list_remove (&f_entry->own_elem);
+  if (list_empty (&f_entry->mappings))
+  {
+    if (f_entry->cached)
+      uncache (f_entry);
+    f_entry->shared = false;
+    f_entry->spte = NULL;
+    used_cnt--;
+    palloc_free_page (f_entry->frame);
+    return;
+  }
+
+  /* Let another process stand for the frame */
+  struct frame_mapping *m = list_entry (list_front (&f_entry->mappings),
+                                        struct frame_mapping, elem);
+  f_entry->spte = m->spte;
+  f_entry->owner = m->owner;
+  f_entry->owner->rss++;
+  list_push_back (&f_entry->owner->own_frames, &f_entry->own_elem);
+  if (!f_entry->cached
+      && list_front (&f_entry->mappings) == list_back (&f_entry->mappings))
+  {
+    /* Left to one process, which can write it once it faults */
+    list_remove (&m->elem);
+    slab_free (&mapping_cache, m);
+    f_entry->shared = false;
+  }
+}
+
+/* Unmaps cached frame F_ENTRY from every process but the one its
+   SPTE and OWNER name, and takes it out of the page cache.  Must
+   be called with frame_lock held. */
+static void
+uncache (struct frame_tab_entry *f_entry)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  while (!list_empty (&f_entry->mappings))
+  {
+    struct frame_mapping *m = list_entry (list_pop_front (&f_entry->mappings),
+                                          struct frame_mapping, elem);
+    if (m->spte != f_entry->spte)
+      pagedir_clear_page (m->owner->pagedir, m->spte->addr);
+    slab_free (&mapping_cache, m);
+  }
+  hash_delete (&page_cache, &f_entry->cache_elem);
+  f_entry->cached = false;
+  f_entry->shared = false;
+}
+
+/* Gives CHILD, being forked from PARENT, PSPTE's page as CSPTE's
+   page, if PARENT has it in memory.  A page in the page cache is
+   simply mapped by one more process; any other page is shared
+   read-only, so that whichever process writes to it first gets a
+   copy of its own (see vm_cow_frame()).  CHILD's copy of the
+   dirty bit is set if PARENT's is, so that the page is still
+   saved on eviction if either process has it dirty.  Returns
+   false if out of memory.  Caller must hold PSPTE's lock. */
+bool
+vm_fork_frame (struct thread *parent, struct suppl_page_table_entry *pspte,
+               struct thread *child, struct suppl_page_table_entry *cspte)
+{
+  struct frame_tab_entry *f_entry;
+  struct frame_mapping *m, *m2;
+  bool success = false;
+  void *frame;
+
+  m = slab_alloc (&mapping_cache);
+  m2 = slab_alloc (&mapping_cache);
+  if (m == NULL || m2 == NULL)
+    goto done;
+
+  lock_acquire (&frame_lock);
+  frame = pagedir_get_page (parent->pagedir, pspte->addr);
+  if (frame == NULL)
+  {
+    /* Dropped from the page cache: CHILD reads it from the file */
+    success = true;
+    goto done_locked;
+  }
+  if (!pagedir_set_page (child->pagedir, cspte->addr, frame, false))
+    goto done_locked;
+  if (frame == zero_page)
+  {
+    success = true;
+    goto done_locked;
+  }
+  f_entry = frame_to_entry (frame);
+
+  if (!f_entry->shared)
+  {
+    share_frame (f_entry, m2);
+    m2 = NULL;
+  }
+  m->owner = child;
+  m->spte = cspte;
+  list_push_back (&f_entry->mappings, &m->elem);
+  m = NULL;
+
+  if (!f_entry->cached)
+  {
+    pagedir_set_writable (parent->pagedir, pspte->addr, false);
+    if (pagedir_is_dirty (parent->pagedir, pspte->addr))
+      pagedir_set_dirty (child->pagedir, cspte->addr, true);
+  }
+  success = true;
+
+ done_locked:
+  lock_release (&frame_lock);
+ done:
+  slab_free (&mapping_cache, m);
+  slab_free (&mapping_cache, m2);
+  return success;
+}
+
+/* Maps the zero page read-only at SPTE's page in the current
+   process.  Returns false if out of memory. */
+bool
+vm_map_zero_page (struct suppl_page_table_entry *spte)
+{
+  return install_page (spte->addr, zero_page, false);
+}
+
+/* Handles a write by the current process to SPTE's page, which is
+   mapped read-only because fork() left the frame to be copied on
+   write, or because it is the zero page.  Gives the process a
+   copy of its own, unless no other process maps the frame any
+   longer, in which case it just makes the frame writable.
+   Returns false if out of memory.  Caller must hold SPTE's lock,
+   which keeps the shared frame from being evicted. */
+bool
+vm_cow_frame (struct suppl_page_table_entry *spte)
+{
+  struct thread *cur = thread_current ();
+  struct frame_tab_entry *f_entry;
+  void *frame, *copy;
+
+  lock_acquire (&frame_lock);
+  frame = pagedir_get_page (cur->pagedir, spte->addr);
+  if (frame == NULL)
+  {
+    /* Gone since the fault: let the access fault again */
+    lock_release (&frame_lock);
+    return true;
+  }
+  if (frame == zero_page)
+  {
+    lock_release (&frame_lock);
+
+    /* A page of zeros of its own */
+    copy = vm_get_frame (PAL_USER | PAL_ZERO, spte);
+    if (copy == NULL)
+      return false;
+    pagedir_clear_page (cur->pagedir, spte->addr);
+    if (!install_page (spte->addr, copy, true))
+    {
+      vm_free_frame (copy);
+      return false;
     }
+    return true;
+  }
+  f_entry = frame_to_entry (frame);
+  if (!f_entry->shared)
+  {
+    pagedir_set_writable (cur->pagedir, spte->addr, true);
     lock_release (&frame_lock);
+    return true;
   }
+  lock_release (&frame_lock);
+
+  copy = vm_get_frame (PAL_USER, spte);
+  if (copy == NULL)
+    return false;
+  memcpy (copy, frame, PGSIZE);
+
+  lock_acquire (&frame_lock);
+  unmap_shared (f_entry, cur, spte);
+  lock_release (&frame_lock);
+
+  if (!install_page (spte->addr, copy, true))
+  {
+    vm_free_frame (copy);
+    return false;
+  }
+  return true;
 }
 
+/* Pins FRAME, which the current process maps, so that it stays in
+   memory until vm_unpin_frame().  A system call pins the pages of
+   its user buffer for the duration of the call, so that it never
+   faults on the buffer while holding file_lock.  Pins nest.  The
+   zero page, never evicted, needs no pin.  Caller must hold the
+   lock of the SPTE the frame holds, so that the frame is not
+   evicted before it is pinned. */
 void
-vm_clear_process_frame_table (pid_t pid)
+vm_pin_frame (void *frame)
 {
-  if (pid != NULL)
-  {
-    struct list_elem *e = list_begin (&frame_table);
-    struct list_elem *next;
-    struct frame_tab_entry *ft_entry;
+  if (frame == zero_page)
+    return;
+  lock_acquire (&frame_lock);
+  frame_to_entry (frame)->pin_cnt++;
+  lock_release (&frame_lock);
+}
 
-    lock_acquire (&frame_lock);
-    while (e != list_end (&frame_table))
+/* Undoes one vm_pin_frame() of FRAME. */
+void
+vm_unpin_frame (void *frame)
+{
+  if (frame == zero_page)
+    return;
+  lock_acquire (&frame_lock);
+  ASSERT (frame_to_entry (frame)->pin_cnt > 0);
+  frame_to_entry (frame)->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Tries to lock the SPTEs of all the processes that map shared
+   frame F_ENTRY other than the one its SPTE names, which the
+   caller has locked.  Returns true if successful; otherwise
+   locks none of them. */
+static bool
+lock_sharers (struct frame_tab_entry *f_entry)
+{
+  struct list_elem *e, *f;
+
+  for (e = list_begin (&f_entry->mappings); e != list_end (&f_entry->mappings);
+       e = list_next (e))
+  {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    if (m->spte != f_entry->spte && !spte_try_lock (m->spte))
     {
-      next = list_next (e);
-      ft_entry = list_entry (e, struct frame_tab_entry, elem);
-      if (ft_entry->owner == pid)
+      for (f = list_begin (&f_entry->mappings); f != e; f = list_next (f))
       {
-        /* Just clear entries */
-        list_remove (e);
-        free (ft_entry);
+        m = list_entry (f, struct frame_mapping, elem);
+        if (m->spte != f_entry->spte)
+          lock_release (&m->spte->spte_lock);
       }
-      e = next;
+      return false;
     }
-    lock_release (&frame_lock);
   }
+  return true;
 }
 
-void *
-try_evict_frame (struct suppl_page_table_entry *e)
+/* Returns true if any process that maps F_ENTRY has accessed it
+   since the last call, and clears the accessed bits. */
+static bool
+frame_accessed (struct frame_tab_entry *f_entry)
 {
-  struct thread *cur = thread_current ();
-  
-  /* First round search, try to find unaccessed upage */
-  struct frame_tab_entry *f_entry = find_unaccessed_page (e);
-  if (f_entry != NULL)
+  struct list_elem *e;
+  bool accessed = false;
+
+  if (!f_entry->shared)
   {
-    return do_evict_frame (e, f_entry);
+    uint32_t *pd = f_entry->owner->pagedir;
+    accessed = pagedir_is_accessed (pd, f_entry->spte->addr);
+    pagedir_set_accessed (pd, f_entry->spte->addr, false);
+    return accessed;
   }
-    
-  /* Second round search, try to find the upage with longest time */
-  f_entry = find_longest_time_page (e);
-  if (f_entry != NULL)
-    return do_evict_frame (e, f_entry);
-  else
-    return NULL;
+
+  for (e = list_begin (&f_entry->mappings); e != list_end (&f_entry->mappings);
+       e = list_next (e))
+  {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    if (pagedir_is_accessed (m->owner->pagedir, m->spte->addr))
+    {
+      accessed = true;
+      pagedir_set_accessed (m->owner->pagedir, m->spte->addr, false);
+    }
+  }
+  return accessed;
 }
 
+/* Evicts a page chosen by the clock algorithm and returns its
+   frame, which then belongs to the caller with its entry still
+   marked as evicting.  Returns NULL if nothing can be evicted.
+   Must be called with frame_lock held; releases it while the
+   page is written out and reacquires it before returning. */
 void *
-find_unaccessed_page (struct suppl_page_table_entry *e)
+try_evict_frame (void)
+{
+  struct frame_tab_entry *f_entry = clock_select (NULL);
+  if (f_entry == NULL)
+    return NULL;
+  return do_evict_frame (f_entry);
+}
+
+/* Global clock: sweeps the hand over every frame in the system,
+   whoever owns it.  A page whose accessed bit is set in its
+   owner's page directory (in any of them, for a page shared
+   through the page cache) gets the bit cleared and a second
+   chance; the first page found with the bit clear is the victim.
+   The hand stays where it stopped, so each fault only examines
+   the frames used since the last one, amortized O(1).
+   Pages of a process over its RSS limit, or holding more than its
+   working set, get no second chance, so that such processes give
+   up frames before the others.
+   Frames not mapped yet, because their page is still being read
+   in, frames already being evicted and pinned frames are passed
+   over, as are pages whose SPTE is locked by someone else.  On
+   success the victim's SPTE is locked, and for a copy-on-write
+   frame, the SPTEs of all the processes sharing it.  Returns NULL
+   only if no frame is eligible at all.
+   If OWNER is nonnull, looks only at the frames OWNER has to
+   itself, to replace one of OWNER's pages with another.  These
+   are on OWNER's own_frames, which is then the clock, rotated
+   as its hand moves, so that the search takes time in OWNER's
+   resident set rather than in all of memory.  Must be called
+   with frame_lock held. */
+static struct frame_tab_entry *
+clock_select (struct thread *owner)
 {
-  struct thread *cur = thread_current();
-  struct list_elem* search = list_begin(&frame_table);
-  struct list_elem* search_end = list_end(&frame_table);
+  size_t n;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
 
-  while(search != search_end)
+  if (owner != NULL)
   {
-    lock_acquire (&frame_lock);
-    struct frame_tab_entry* f_entry = list_entry (search, struct frame_tab_entry, elem);
+    /* Two turns suffice here too.  A victim leaves the list in
+       evict_begin(), after it has gone to the back. */
+    for (n = 0; n < 2 * owner->rss; n++)
+    {
+      struct list_elem *e = list_pop_front (&owner->own_frames);
+      struct frame_tab_entry *f_entry;
+
+      list_push_back (&owner->own_frames, e);
+      f_entry = list_entry (e, struct frame_tab_entry, own_elem);
+      if (!f_entry->shared && clock_try (f_entry, true))
+        return f_entry;
+    }
+    return NULL;
+  }
 
-    /* If current page is not accessed, evict it */
-    if (!pagedir_is_accessed (cur->pagedir, f_entry->spte->addr))
+  /* Two sweeps suffice: the first clears every accessed bit. */
+  for (n = 0; n < 2 * frame_cnt; n++)
+  {
+    struct frame_tab_entry *f_entry = &frame_table[clock_hand];
+    clock_hand = (clock_hand + 1) % frame_cnt;
+    if (clock_hand == 0)
     {
-      /* Note: lock is not released here, and will be released in do_evict_frame() */
-      lock_release (&frame_lock);
+      /* The hand has gone round: see which processes need all
+         the frames they have */
+      enum intr_level old_level = intr_disable ();
+      thread_foreach (clock_turned, NULL);
+      intr_set_level (old_level);
+    }
+    if (clock_try (f_entry, false))
       return f_entry;
+  }
+
+  return NULL;
+}
+
+/* Looks at F_ENTRY under the clock hand, for clock_select().
+   Returns true, with its SPTE (and its sharers') locked, if it is
+   to be evicted.  A page gets a second chance if its accessed bit
+   is set and either FAVORED is true or its process is within its
+   RSS limit and working set. */
+static bool
+clock_try (struct frame_tab_entry *f_entry, bool favored)
+{
+  if (f_entry->spte == NULL || f_entry->evicting || f_entry->pin_cnt > 0)
+    return false;
+
+  uint32_t *pd = f_entry->owner->pagedir;
+  void *upage = f_entry->spte->addr;
+  if (pagedir_get_page (pd, upage) != f_entry->frame)
+    return false;
+
+  struct thread *t = f_entry->owner;
+  favored = favored
+            || (!t->ws_over && (t->rss_limit == 0 || t->rss <= t->rss_limit));
+  if ((frame_accessed (f_entry) && favored)
+      || !spte_try_lock (f_entry->spte))
+    return false;
+  if (!f_entry->shared || f_entry->cached || lock_sharers (f_entry))
+    return true;
+  lock_release (&f_entry->spte->spte_lock);
+  return false;
+}
+
+/* Tries to lock SPTE, for eviction.  Fails, rather than trip over
+   its own lock, if the current thread already holds it: it is
+   then in the middle of loading or copying that very page. */
+static bool
+spte_try_lock (struct suppl_page_table_entry *spte)
+{
+  return !lock_held_by_current_thread (&spte->spte_lock)
+         && lock_try_acquire (&spte->spte_lock);
+}
+
+/* Called for each thread T when the clock hand has gone round.
+   A process that took fewer than WS_FAULTS page faults over the
+   whole turn had every page it used in memory, and probably more:
+   it is over its working set until the next turn.  A process
+   that faults more often needs the frames it has. */
+static void
+clock_turned (struct thread *t, void *aux UNUSED)
+{
+  t->ws_over = t->vmstat.faults - t->ws_fault_cnt < WS_FAULTS;
+  t->ws_fault_cnt = t->vmstat.faults;
+}
+
+/* A page on its way out of memory.  Eviction happens in three
+   steps: evict_begin() unmaps the page, with frame_lock held;
+   then, without the lock, evict_write_file() or swap_out*() saves
+   the page if need be; and evict_end() finishes up, with the lock
+   held again.  The SPTE stays locked throughout. */
+struct victim
+{
+  struct frame_tab_entry *f_entry;        /* The frame */
+  struct suppl_page_table_entry *spte;    /* The page it held */
+  struct thread *owner;                   /* The page's process */
+  bool dirty;                             /* Modified since loaded? */
+};
+
+/* Starts evicting the page in F_ENTRY, whose SPTE the caller has
+   locked, filling in V.  Returns true if the page has to go to
+   swap, false if it can be dropped or written to its file. */
+static bool
+evict_begin (struct frame_tab_entry *f_entry, struct victim *v)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+  ASSERT (lock_held_by_current_thread (&f_entry->spte->spte_lock));
+
+  v->f_entry = f_entry;
+  v->spte = f_entry->spte;
+  v->owner = f_entry->owner;
+  v->owner->rss--;
+  list_remove (&f_entry->own_elem);
+  v->owner->vmstat.evictions++;
+
+  /* A cached page is read-only, so clean: unmap it from the other
+     processes that share it, then drop it like any clean page */
+  if (f_entry->cached)
+    uncache (f_entry);
+
+  /* Unmap the page before saving it anywhere, so that its owner
+     cannot change it behind our back.  The owner's next access
+     faults, and the fault waits for the SPTE's lock. */
+  v->dirty = pagedir_is_dirty (v->owner->pagedir, v->spte->addr);
+  pagedir_clear_page (v->owner->pagedir, v->spte->addr);
+  if (f_entry->shared)
+  {
+    /* Copy on write: the same goes for every process sharing it.
+       They go where this one goes; evict_end() updates them. */
+    struct list_elem *e;
+    for (e = list_begin (&f_entry->mappings);
+         e != list_end (&f_entry->mappings); e = list_next (e))
+    {
+      struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+      v->dirty |= pagedir_is_dirty (m->owner->pagedir, m->spte->addr);
+      pagedir_clear_page (m->owner->pagedir, m->spte->addr);
+      if (m->spte != v->spte)
+        m->owner->vmstat.evictions++;
     }
-    else
+  }
+  f_entry->evicting = true;
+  f_entry->spte = NULL;
+
+  /* Anonymous pages, and private modified copies of executable
+     data, can only go to swap.  Otherwise the page is
+     file-backed: if clean, the file still holds what the page
+     does, so it is dropped and the SPTE loads it from the file
+     again on the next fault */
+  return v->spte->type == type_swap
+         || (v->dirty && v->spte->type == type_file);
+}
+
+/* Writes V's page back to its file if it is a modified mmap page. */
+static void
+evict_write_file (struct victim *v)
+{
+  if (v->dirty && v->spte->type == type_mmap)
+  {
+    lock_acquire (&file_lock);
+    file_write_at (v->spte->file, v->f_entry->frame,
+                    v->spte->read_bytes, v->spte->offset);
+    lock_release (&file_lock);
+  }
+}
+
+/* Finishes evicting V's page, given that it went to swap slot
+   SLOT (or SWAP_SLOT_NONE if it did not go to swap). */
+static void
+evict_end (struct victim *v, size_t slot)
+{
+  struct frame_tab_entry *f_entry = v->f_entry;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  /* The other processes sharing a copy-on-write page share its
+     swap slot too */
+  while (f_entry->shared && !list_empty (&f_entry->mappings))
+  {
+    struct frame_mapping *m = list_entry (list_pop_front (&f_entry->mappings),
+                                          struct frame_mapping, elem);
+    if (m->spte != v->spte)
     {
-      /* Reset timestamp, prepare for the second round */
-      f_entry->spte->timestamp = timer_ticks();
+      if (slot != SWAP_SLOT_NONE)
+      {
+        m->spte->swap_idx = slot;
+        m->spte->type = type_swap;
+        swap_dup (slot);
+      }
+      lock_release (&m->spte->spte_lock);
     }
-    
-    search = list_next(search);
-    lock_release (&frame_lock);
+    slab_free (&mapping_cache, m);
   }
+  f_entry->shared = false;
 
-  return NULL;
+  if (slot != SWAP_SLOT_NONE)
+  {
+    v->spte->swap_idx = slot;
+    v->spte->type = type_swap;
+  }
+  lock_release (&v->spte->spte_lock);
 }
 
+/* Evicts the page in F_ENTRY, whose SPTE the caller has locked,
+   and returns its frame, zeroed.  See try_evict_frame(). */
 void *
-find_longest_time_page (struct suppl_page_table_entry *e)
+do_evict_frame (struct frame_tab_entry *f_entry)
+{
+  struct victim v;
+  size_t slot = SWAP_SLOT_NONE;
+
+  bool to_swap = evict_begin (f_entry, &v);
+  lock_release (&frame_lock);
+
+  if (to_swap)
+    slot = swap_out (f_entry->frame, v.spte, v.owner);
+  else
+    evict_write_file (&v);
+  memset (f_entry->frame, 0, PGSIZE);
+
+  lock_acquire (&frame_lock);
+  evict_end (&v, slot);
+  return f_entry->frame;
+}
+
+/* Evicts up to SWAP_CLUSTER pages, or fewer if that brings the
+   number of free frames up to high_water, and frees their
+   frames.  The pages that go to swap are written together, so
+   that pages of one process that lie in adjacent slots take a
+   single transfer.  Returns the number of frames freed.
+   Called with frame_lock held; releases it during the writes. */
+static size_t
+pageout_batch (void)
 {
-  struct list_elem* search = list_begin(&frame_table);
-  struct list_elem* search_end = list_end(&frame_table);
-  int64_t first_begin_time = INT64_MAX;
-  struct frame_tab_entry *first_begin_entry = NULL;
+  struct victim victims[SWAP_CLUSTER];
+  struct swap_page swaps[SWAP_CLUSTER];
+  size_t to_swap[SWAP_CLUSTER];
+  size_t victim_cnt, swap_cnt, i;
 
-  while(search != search_end)
+  swap_cnt = 0;
+  for (victim_cnt = 0; victim_cnt < SWAP_CLUSTER
+         && frame_cnt - used_cnt + victim_cnt < high_water; victim_cnt++)
   {
-    lock_acquire (&frame_lock);
-    struct frame_tab_entry* f_entry = list_entry (search, struct frame_tab_entry, elem);
+    struct frame_tab_entry *f_entry = clock_select (NULL);
+    struct victim *v = &victims[victim_cnt];
 
-    /* Get the one with least timer_ticks */
-    if (f_entry->spte->timestamp < first_begin_time)
+    if (f_entry == NULL)
+      break;
+    to_swap[victim_cnt] = SWAP_SLOT_NONE;
+    if (evict_begin (f_entry, v))
     {
-      first_begin_time = f_entry->spte->timestamp;
-      first_begin_entry = f_entry;
+      swaps[swap_cnt].frame = f_entry->frame;
+      swaps[swap_cnt].spte = v->spte;
+      swaps[swap_cnt].owner = v->owner;
+      to_swap[victim_cnt] = swap_cnt++;
     }
+  }
+  if (victim_cnt == 0)
+    return 0;
+  lock_release (&frame_lock);
+
+  for (i = 0; i < victim_cnt; i++)
+    if (to_swap[i] == SWAP_SLOT_NONE)
+      evict_write_file (&victims[i]);
+  swap_out_batch (swaps, swap_cnt);
 
-    search = list_next(search);
+  lock_acquire (&frame_lock);
+  for (i = 0; i < victim_cnt; i++)
+  {
+    struct victim *v = &victims[i];
+
+    evict_end (v, to_swap[i] != SWAP_SLOT_NONE
+                  ? swaps[to_swap[i]].slot : SWAP_SLOT_NONE);
+    v->f_entry->evicting = false;
+    used_cnt--;
+    palloc_free_page (v->f_entry->frame);
+  }
+  return victim_cnt;
+}
+
+/* Pageout daemon.  Each time a fault leaves fewer than
+   low_water frames free, evicts pages in clock order until
+   high_water frames are free, doing the swap and file writes
+   here rather than in the faulting thread, then writes back
+   dirty mmap pages just ahead of the hand. */
+static void
+pageout_daemon (void *aux UNUSED)
+{
+  for (;;)
+  {
+    sema_down (&pageout_sema);
+
+    lock_acquire (&frame_lock);
+    while (frame_cnt - used_cnt < high_water)
+      if (pageout_batch () == 0)
+        break;
+    flush_frames (clock_hand, PRECLEAN_SCAN);
+    pageout_running = false;
     lock_release (&frame_lock);
   }
+}
+
+/* Write-back daemon.  Every FLUSH_INTERVAL ticks, writes back
+   the dirty mmap pages in the whole frame table, so that a
+   long-running process's changes reach its files without waiting
+   for munmap(), msync() or eviction. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+  {
+    timer_sleep (FLUSH_INTERVAL);
 
-  return first_begin_entry;
+    lock_acquire (&frame_lock);
+    flush_frames (0, frame_cnt);
+    lock_release (&frame_lock);
+  }
 }
 
-void *
-do_evict_frame (struct suppl_page_table_entry *e, struct frame_tab_entry *f_entry)
+/* Writes back the dirty mmap pages among the CNT frames starting
+   at frame_table[START], leaving them mapped.  Clears the dirty
+   bit before writing, so a store during the write marks the page
+   dirty again.  Pages are taken FLUSH_BATCH at a time, and the
+   ones in a batch that are adjacent in the same file go out in a
+   single write.
+   Called with frame_lock held; releases it during the writes. */
+static void
+flush_frames (size_t start, size_t cnt)
 {
-  ASSERT(e != NULL && f_entry != NULL);
-  
-  lock_acquire (&frame_lock);
-  lock_acquire (&e->spte_lock);
-  struct thread *cur = thread_current();
-  
-  void *evi_frame = f_entry->frame;
-  struct suppl_page_table_entry *evi_pte = f_entry->spte;
-  uint8_t *evi_upage = evi_pte->addr;
-  pid_t owner = f_entry->owner;
+  struct frame_tab_entry *batch[FLUSH_BATCH];
+  size_t idx = start;
+  size_t i = 0, n, j;
 
-  /* If the page is dirty (modified), write it back to file */
-  if (pagedir_is_dirty (cur->pagedir, evi_pte->addr) && 
-      (evi_pte->type == type_mmap))
+  if (cnt > frame_cnt)
+    cnt = frame_cnt;
+  while (i < cnt)
   {
-    lock_acquire (&file_lock);
-    file_write_at (evi_pte->file, evi_pte->addr,
-                    evi_pte->read_bytes, evi_pte->offset);
-    lock_release (&file_lock);
-  } 
-  else
+    for (n = 0; i < cnt && n < FLUSH_BATCH; i++, idx = (idx + 1) % frame_cnt)
+    {
+      struct frame_tab_entry *f_entry = &frame_table[idx];
+      struct suppl_page_table_entry *spte = f_entry->spte;
+
+      if (spte == NULL || f_entry->evicting || spte->type != type_mmap)
+        continue;
+
+      uint32_t *pd = f_entry->owner->pagedir;
+      if (pagedir_get_page (pd, spte->addr) != f_entry->frame
+          || !pagedir_is_dirty (pd, spte->addr)
+          || !lock_try_acquire (&spte->spte_lock))
+        continue;
+
+      pagedir_set_dirty (pd, spte->addr, false);
+      f_entry->evicting = true;
+      batch[n++] = f_entry;
+    }
+    if (n == 0)
+      continue;
+
+    lock_release (&frame_lock);
+    flush_batch (batch, n);
+    lock_acquire (&frame_lock);
+
+    for (j = 0; j < n; j++)
+    {
+      batch[j]->evicting = false;
+      lock_release (&batch[j]->spte->spte_lock);
+    }
+  }
+}
+
+/* Writes the N frames in BATCH, which hold mmap pages, to their
+   files, each run of pages that follow one another in the same
+   file in one write.  Sorts BATCH. */
+static void
+flush_batch (struct frame_tab_entry **batch, size_t n)
+{
+  size_t i, j;
+
+  /* Insertion sort by file, then offset */
+  for (i = 1; i < n; i++)
   {
-    /* Use swap */
-    f_entry->spte->type = type_swap;
-    f_entry->spte->swap_idx = swap_out (evi_frame);
+    struct frame_tab_entry *f_entry = batch[i];
+    struct suppl_page_table_entry *spte = f_entry->spte;
+
+    for (j = i; j > 0; j--)
+    {
+      struct suppl_page_table_entry *prev = batch[j - 1]->spte;
+      if (prev->file < spte->file
+          || (prev->file == spte->file && prev->offset < spte->offset))
+        break;
+      batch[j] = batch[j - 1];
+    }
+    batch[j] = f_entry;
   }
 
-  /* Set the page to not present and fill it with 0 */
-  pagedir_clear_page (thread_get_by_tid(owner)->pagedir, evi_upage);
-  memset (evi_frame, 0, PGSIZE);
+  for (i = 0; i < n; i = j)
+  {
+    struct suppl_page_table_entry *first = batch[i]->spte;
+    uint32_t bytes = first->read_bytes;
+    uint8_t *buffer = NULL;
 
-  /* Remove the original frame_tab_entry */
-  list_remove (&f_entry->elem);
-  free (f_entry);
+    /* Find the run starting at BATCH[I] */
+    for (j = i + 1; j < n; j++)
+    {
+      struct suppl_page_table_entry *prev = batch[j - 1]->spte;
+      struct suppl_page_table_entry *spte = batch[j]->spte;
+      if (spte->file != first->file || prev->read_bytes != PGSIZE
+          || spte->offset != prev->offset + PGSIZE)
+        break;
+      bytes += spte->read_bytes;
+    }
 
-  /* Create a new frame_tab_entry */
-  struct frame_tab_entry *new_ft_entry = malloc (sizeof (struct frame_tab_entry));
-  new_ft_entry->frame = evi_frame;
-  new_ft_entry->spte = e;
-  new_ft_entry->owner = thread_tid();
-  list_push_back (&frame_table, &new_ft_entry->elem);
+    /* Gather a run of more than one page into a buffer, or failing
+       that write its pages one by one */
+    if (j - i > 1)
+      buffer = palloc_get_multiple (0, j - i);
+    if (buffer == NULL)
+      j = i + 1;
+    else
+    {
+      size_t k;
+      for (k = i; k < j; k++)
+        memcpy (buffer + (k - i) * PGSIZE, batch[k]->frame,
+                batch[k]->spte->read_bytes);
+    }
 
-  lock_release (&e->spte_lock);
-  lock_release (&frame_lock);
-  return evi_frame;
-}
\ No newline at end of file
+    lock_acquire (&file_lock);
+    if (buffer != NULL)
+      file_write_at (first->file, buffer, bytes, first->offset);
+    else
+      file_write_at (first->file, batch[i]->frame, first->read_bytes,
+                     first->offset);
+    lock_release (&file_lock);
+
+    if (buffer != NULL)
+      palloc_free_multiple (buffer, j - i);
+  }
+}
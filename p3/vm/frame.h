@@ -1,28 +1,61 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
+#include <stddef.h>
+#include <hash.h>
 #include <list.h>
+#include "devices/block.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "page.h"
 
 typedef int pid_t;
 
-struct list frame_table;
-
+/* One entry per frame in the user pool, indexed by frame number.
+   A frame in the page cache, or one that fork() left to parent and
+   child to copy on write, may be mapped by several processes;
+   SPTE and OWNER are then one of its MAPPINGS. */
 struct frame_tab_entry
 {
   void *frame;                            /* Actual frame addr */
-  struct suppl_page_table_entry *spte;    /* Corresponding suppl_page_table_entry */
-  pid_t owner;                            /* Used to identify the owner thread/process */
-  struct list_elem elem;
+  struct suppl_page_table_entry *spte;    /* Corresponding suppl_page_table_entry, NULL if frame is free */
+  struct thread *owner;                   /* Process whose page directory maps the frame */
+  bool evicting;                          /* Being written out, leave it alone */
+  unsigned pin_cnt;                       /* Pinned by system calls, not to be evicted */
+  struct list_elem own_elem;              /* Element in OWNER's own_frames */
+
+  /* Sharing, for read-only file pages and copy-on-write */
+  bool shared;                            /* MAPPINGS in use? */
+  struct list mappings;                   /* struct frame_mapping, one per process */
+  bool cached;                            /* In the page cache? */
+  block_sector_t sector;                  /* Inode of the file the page is from */
+  off_t offset;                           /* Offset of the page in the file */
+  struct hash_elem cache_elem;            /* Element in the page cache */
+};
+
+/* One process's mapping of a shared frame. */
+struct frame_mapping
+{
+  struct thread *owner;                   /* Process */
+  struct suppl_page_table_entry *spte;    /* Its page */
+  struct list_elem elem;                  /* Element in frame_tab_entry's mappings */
 };
 
 void vm_frame_table_init (void);
+void vm_pageout_init (void);
 void *vm_get_frame (enum palloc_flags, void *);
+void *vm_try_get_frame (void *);
 void vm_free_frame (void *frame);
-void vm_clear_process_frame_table (pid_t pid);
-void *try_evict_frame (struct suppl_page_table_entry *);
-void *do_evict_frame (struct suppl_page_table_entry *, struct frame_tab_entry *);
+void vm_clear_process_frame_table (struct thread *);
+bool vm_map_cached_frame (struct suppl_page_table_entry *);
+void vm_cache_frame (void *, struct suppl_page_table_entry *);
+bool vm_fork_frame (struct thread *, struct suppl_page_table_entry *,
+                    struct thread *, struct suppl_page_table_entry *);
+bool vm_map_zero_page (struct suppl_page_table_entry *);
+bool vm_cow_frame (struct suppl_page_table_entry *);
+void vm_pin_frame (void *);
+void vm_unpin_frame (void *);
+void *try_evict_frame (void);
+void *do_evict_frame (struct frame_tab_entry *);
 
 #endif
\ No newline at end of file
@@ -2,11 +2,89 @@
 #include "page.h"
 #include "frame.h"
 #include "swap.h"
+#include "vma.h"
 #include "filesys/filesys.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "threads/slab.h"
 #include "userprog/syscall.h"
 
+static struct slab_cache mmap_cache;
+
+/* Initializes the mmap_entry cache. */
+void
+mmap_init (void)
+{
+  slab_cache_init (&mmap_cache, "mmap_entry", sizeof (struct mmap_entry), NULL);
+}
+
+/* Returns a new, uninitialized mmap_entry, or NULL if out of
+   memory. */
+struct mmap_entry *
+mmap_entry_alloc (void)
+{
+  return slab_alloc (&mmap_cache);
+}
+
+/* Frees E, which must not be in any mmap_list. */
+void
+mmap_entry_free (struct mmap_entry *e)
+{
+  slab_free (&mmap_cache, e);
+}
+
+/* Writes the dirty pages of E, a mapping of the current process,
+   back to its file, each run of consecutive dirty pages in a
+   single write straight from the mapping.  The pages stay mapped,
+   and clean until written again. */
+void
+sync_mmap_entry (struct mmap_entry *e)
+{
+  struct thread *cur = thread_current ();
+  unsigned i = 0, j;
+
+  while (i < e->page_num)
+  {
+    uint32_t bytes = 0;
+
+    /* Lock the run of dirty pages starting at page I.  Holding
+       their locks keeps them in memory during the write. */
+    for (j = i; j < e->page_num; j++)
+    {
+      void *upage = e->uvaddr + j * PGSIZE;
+      struct suppl_page_table_entry *spte = page_hash_find (&cur->suppl_page_table, upage);
+      if (spte == NULL)
+        break;
+      lock_acquire (&spte->spte_lock);
+      if (pagedir_get_page (cur->pagedir, upage) == NULL
+          || !pagedir_is_dirty (cur->pagedir, upage))
+      {
+        lock_release (&spte->spte_lock);
+        break;
+      }
+      pagedir_set_dirty (cur->pagedir, upage, false);
+      bytes += spte->read_bytes;
+    }
+    if (j == i)
+    {
+      i++;
+      continue;
+    }
+
+    lock_acquire (&file_lock);
+    file_write_at (e->file, e->uvaddr + i * PGSIZE, bytes, i * PGSIZE);
+    lock_release (&file_lock);
+
+    for (; i < j; i++)
+    {
+      struct suppl_page_table_entry *spte = page_hash_find (&cur->suppl_page_table, e->uvaddr + i * PGSIZE);
+      lock_release (&spte->spte_lock);
+    }
+  }
+}
+
+/* Unmaps E, a mapping of the current process, after writing its
+   dirty pages back. */
 void 
 free_mmap_entry (struct mmap_entry *e)
 {
@@ -14,6 +92,7 @@ free_mmap_entry (struct mmap_entry *e)
   struct suppl_page_table_entry *spte;
   unsigned int page_num = e->page_num;
 
+  sync_mmap_entry (e);
   for (unsigned i = 0; i < page_num; i++)
   {
     void *upage = e->uvaddr + i * PGSIZE;
@@ -22,13 +101,6 @@ free_mmap_entry (struct mmap_entry *e)
       continue;
     lock_acquire (&spte->spte_lock);
     
-    /* Write back to file if the page is dirty */
-    if (pagedir_is_dirty (cur->pagedir, upage))
-    { 
-      lock_acquire (&file_lock);
-      file_write_at (spte->file, upage, spte->read_bytes, spte->offset);
-      lock_release (&file_lock);
-    }
     /* Free the frame if allocated. */
     if (spte->free == false)
     {       
@@ -38,7 +110,9 @@ free_mmap_entry (struct mmap_entry *e)
 
     hash_delete (&cur->suppl_page_table, &spte->hash_elem); 
     lock_release (&spte->spte_lock);
+    page_free_spte (spte);
   }
+  vma_remove (cur, e->uvaddr);
   file_close (e->file);
 }
 
@@ -14,6 +14,10 @@ struct mmap_entry
   struct list_elem elem;  /* The hash_elem used to become an elem in a hash table */
 };
 
+void mmap_init (void);
+struct mmap_entry *mmap_entry_alloc (void);
+void mmap_entry_free (struct mmap_entry *);
+void sync_mmap_entry (struct mmap_entry *);
 void free_mmap_entry (struct mmap_entry *);
 void free_mmap_list (struct list *);
 
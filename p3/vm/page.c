@@ -3,29 +3,62 @@
 #include <debug.h>
 #include <hash.h>
 #include <string.h>
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "userprog/syscall.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "swap.h"
+#include "vma.h"
 
 void free_func (struct hash_elem *e, void *aux UNUSED);
+static size_t fault_around (struct suppl_page_table_entry *,
+                            struct suppl_page_table_entry **, void **);
+
+/* Number of pages following a faulting file page that
+   page_load_file() reads in along with it, in the same read,
+   while free frames last.  Set with the -fault-around kernel
+   option; capped at FAULT_AROUND_MAX. */
+unsigned page_fault_around = 4;
+
+/* Where SPTEs come from.  Each comes with its lock initialized. */
+static struct slab_cache spte_cache;
+
+static void
+spte_ctor (void *spte_)
+{
+  struct suppl_page_table_entry *spte = spte_;
+  lock_init (&spte->spte_lock);
+}
+
+/* Initializes the SPTE and VMA caches. */
+void
+page_init (void)
+{
+  slab_cache_init (&spte_cache, "spte", sizeof (struct suppl_page_table_entry),
+                   spte_ctor);
+  vma_init ();
+}
  	
 /* Returns a hash value for page p_. */
 unsigned
 page_hash (const struct hash_elem *p_, void *aux UNUSED)
 {
-  const struct suppl_page_table_entry * e = hash_entry (p_, struct suppl_page_table_entry, hash_elem);
+  const struct suppl_page_table_entry * e
+    = hash_entry (p_, struct suppl_page_table_entry, hash_elem);
   return hash_bytes (&e->addr, sizeof (e->addr));
 }
 
 /* Returns true if page a_ is in the front of page b_. */
 bool
-page_less (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
 {
-  const struct suppl_page_table_entry *a = hash_entry (a_, struct suppl_page_table_entry, hash_elem);
-  const struct suppl_page_table_entry *b = hash_entry (b_, struct suppl_page_table_entry, hash_elem);
+  const struct suppl_page_table_entry *a
+    = hash_entry (a_, struct suppl_page_table_entry, hash_elem);
+  const struct suppl_page_table_entry *b
+    = hash_entry (b_, struct suppl_page_table_entry, hash_elem);
 
   return a->addr < b->addr;
 }
@@ -45,20 +78,113 @@ page_hash_find (struct hash *table, uint8_t *upage)
   return hash_entry (found_elem, struct suppl_page_table_entry, hash_elem);
 }
 
+/* Brings in the page SPTE describes from wherever it is now.
+   WRITE tells whether the access that faulted was a write: a read
+   of a page that is all zeros, such as a page of BSS, just maps
+   the shared zero page, and the page gets a frame of its own
+   when it is first written.
+   Holds the SPTE's lock throughout, so that if the pageout
+   daemon is still writing the page out, this waits for it to
+   finish and then sees where it went. */
+bool
+page_load (struct suppl_page_table_entry *spte, bool write)
+{
+  bool success = false;
+
+  lock_acquire (&spte->spte_lock);
+  if (!write && spte->type == type_file && spte->read_bytes == 0)
+  {
+    success = vm_map_zero_page (spte);
+    if (success)
+    {
+      spte->free = false;
+      thread_current ()->vmstat.zero_faults++;
+    }
+  }
+  else if (spte->type == type_file || spte->type == type_mmap)
+    success = page_load_file (spte);
+  else if (spte->type == type_swap)
+    success = page_load_swap (spte);
+  lock_release (&spte->spte_lock);
+  return success;
+}
+
+/* Loads SPTE's page from its file.  Caller must hold SPTE's lock. */
 bool 
 page_load_file (struct suppl_page_table_entry *spte)
 {
+  /* Read-only pages, such as code, may already be in memory for
+     another process running the same executable */
+  bool shareable = spte->type == type_file && !spte->writable;
+  if (shareable && vm_map_cached_frame (spte))
+  {
+    spte->free = false;
+    thread_current ()->vmstat.cached_faults++;
+    return true;
+  }
+
+  struct suppl_page_table_entry *near[FAULT_AROUND_MAX];
+  void *near_frame[FAULT_AROUND_MAX];
+  size_t near_cnt, i;
+
   void *frame = vm_get_frame (PAL_USER, spte);
-  ASSERT (frame != NULL)
+  if (frame == NULL)
+    return false;
+
+  /* Read the following pages too, if there are any to read, into
+     a buffer big enough for all of them */
+  uint8_t *buffer = NULL;
+  uint32_t read_bytes = spte->read_bytes;
+  near_cnt = fault_around (spte, near, near_frame);
+  if (near_cnt > 0)
+    buffer = palloc_get_multiple (0, near_cnt + 1);
+  if (buffer == NULL)
+  {
+    for (i = 0; i < near_cnt; i++)
+    {
+      vm_free_frame (near_frame[i]);
+      lock_release (&near[i]->spte_lock);
+    }
+    near_cnt = 0;
+  }
+  for (i = 0; i < near_cnt; i++)
+    read_bytes += near[i]->read_bytes;
 
-  lock_acquire(&spte->spte_lock);
-  
   lock_acquire (&file_lock);
-  off_t ofs = file_read_at (spte->file, frame, spte->read_bytes, spte->offset);
+  off_t ofs = file_read_at (spte->file, buffer != NULL ? buffer : frame,
+                            read_bytes, spte->offset);
   lock_release (&file_lock);
 
+  /* Map the following pages that were read in full */
+  for (i = 0; i < near_cnt; i++)
+  {
+    struct suppl_page_table_entry *n = near[i];
+    off_t start = (i + 1) * PGSIZE;
+
+    if (ofs >= start + (off_t) n->read_bytes)
+    {
+      memcpy (near_frame[i], buffer + start, n->read_bytes);
+      memset (near_frame[i] + n->read_bytes, 0, PGSIZE - n->read_bytes);
+    }
+    if (ofs >= start + (off_t) n->read_bytes
+        && install_page (n->addr, near_frame[i], n->writable))
+    {
+      if (shareable)
+        vm_cache_frame (near_frame[i], n);
+      n->free = false;
+    }
+    else
+      vm_free_frame (near_frame[i]);
+    lock_release (&n->spte_lock);
+  }
+  if (buffer != NULL)
+  {
+    memcpy (frame, buffer, spte->read_bytes);
+    palloc_free_multiple (buffer, near_cnt + 1);
+  }
+
   /* Check if actual read bytes equals to the request */
-  if (ofs != (off_t) spte->read_bytes)
+  if (ofs < (off_t) spte->read_bytes)
   {
     vm_free_frame (frame);
     return false;
@@ -74,22 +200,129 @@ page_load_file (struct suppl_page_table_entry *spte)
     vm_free_frame (frame);
     return false;
   }
+  if (shareable)
+    vm_cache_frame (frame, spte);
   
   /* Set to loaded */
   spte->free = false;
-
-  lock_release(&spte->spte_lock);
+  thread_current ()->vmstat.file_faults++;
   return true;
 }
 
+/* Finds the pages that follow SPTE's page in its file, in the
+   current process's address space, up to page_fault_around of
+   them, as long as they are not in memory yet and free frames are
+   at hand for them.  Locks each one, gets it a frame, and stores
+   both into NEAR and NEAR_FRAME.  Returns the number found.
+   Stops at the first page that does not qualify, so that they
+   can all be read from the file in one go. */
+static size_t
+fault_around (struct suppl_page_table_entry *spte,
+              struct suppl_page_table_entry **near, void **near_frame)
+{
+  struct thread *cur = thread_current ();
+  struct suppl_page_table_entry *prev = spte;
+  size_t max = page_fault_around < FAULT_AROUND_MAX
+               ? page_fault_around : FAULT_AROUND_MAX;
+  size_t cnt = 0;
+
+  while (cnt < max && prev->read_bytes == PGSIZE)
+  {
+    struct suppl_page_table_entry *n;
+
+    n = page_lookup ((uint8_t *) prev->addr + PGSIZE);
+    if (n == NULL || n->file != spte->file || n->writable != spte->writable
+        || n->offset != prev->offset + PGSIZE || n->read_bytes == 0
+        || !lock_try_acquire (&n->spte_lock))
+      break;
+    if (n->type != spte->type
+        || pagedir_get_page (cur->pagedir, n->addr) != NULL
+        || (near_frame[cnt] = vm_try_get_frame (n)) == NULL)
+    {
+      lock_release (&n->spte_lock);
+      break;
+    }
+    near[cnt++] = n;
+    prev = n;
+  }
+  return cnt;
+}
+
+/* Loads SPTE's page from swap.  Caller must hold SPTE's lock.
+   The other pages of this process in the same swap cluster were
+   most likely swapped out along with this one and will be wanted
+   along with it, so they are read in by the same transfer and
+   mapped too, as long as free frames are at hand for them. */
 bool page_load_swap (struct suppl_page_table_entry *spte)
 {
+  struct suppl_page_table_entry *near[SWAP_CLUSTER];
+  struct thread *cur = thread_current ();
+  size_t slot = spte->swap_idx;
+  size_t first = slot - slot % SWAP_CLUSTER;
+  size_t lo = slot, hi = slot;
+  size_t s;
+
   void *frame = vm_get_frame (PAL_USER, spte);
-  ASSERT (frame != NULL)
+  if (frame == NULL)
+    return false;
 
-  lock_acquire (&spte->spte_lock);
+  /* Lock the neighbours still in swap.  Only try: they may be
+     being loaded or evicted right now, and then we leave them. */
+  for (s = first; s < first + SWAP_CLUSTER; s++)
+  {
+    struct suppl_page_table_entry *n
+      = s != slot ? swap_slot_page (s, cur) : NULL;
+    near[s - first] = NULL;
+    if (n == NULL || !lock_try_acquire (&n->spte_lock))
+      continue;
+    if (n->type == type_swap && n->swap_idx == s)
+    {
+      near[s - first] = n;
+      lo = s < lo ? s : lo;
+      hi = s > hi ? s : hi;
+    }
+    else
+      lock_release (&n->spte_lock);
+  }
 
-  swap_in (frame, spte->swap_idx);
+  uint8_t *buffer = hi > lo ? palloc_get_multiple (0, hi - lo + 1) : NULL;
+  if (buffer == NULL)
+  {
+    swap_in (frame, slot);
+    for (s = lo; s <= hi; s++)
+      if (near[s - first] != NULL)
+        lock_release (&near[s - first]->spte_lock);
+  }
+  else
+  {
+    swap_read (buffer, lo, hi - lo + 1);
+    memcpy (frame, buffer + (slot - lo) * PGSIZE, PGSIZE);
+    swap_free (slot);
+
+    for (s = lo; s <= hi; s++)
+    {
+      struct suppl_page_table_entry *n = near[s - first];
+      if (n == NULL)
+        continue;
+
+      void *n_frame = vm_try_get_frame (n);
+      if (n_frame != NULL)
+      {
+        memcpy (n_frame, buffer + (s - lo) * PGSIZE, PGSIZE);
+        if (install_page (n->addr, n_frame, n->writable))
+        {
+          swap_free (s);
+          n->swap_idx = SWAP_SLOT_NONE;
+          n->free = false;
+        }
+        else
+          vm_free_frame (n_frame);
+      }
+      lock_release (&n->spte_lock);
+    }
+    palloc_free_multiple (buffer, hi - lo + 1);
+  }
+  spte->swap_idx = SWAP_SLOT_NONE;
 
   /* Install page */
   if (!install_page (spte->addr, frame, spte->writable))
@@ -100,97 +333,271 @@ bool page_load_swap (struct suppl_page_table_entry *spte)
 
   /* Set to loaded */
   spte->free = false;
-
-  lock_release (&spte->spte_lock);
+  cur->vmstat.swap_faults++;
   return true;
 }
 
+/* Sets up UPAGE and the pages after it to be loaded from FILE
+   at offset OFS when first touched: READ_BYTES bytes from the
+   file, then ZERO_BYTES zeros.  Only records the range as a VMA;
+   the pages get SPTEs when page_lookup() first asks for them.
+   Returns false if the range overlaps one already set up or if
+   out of memory. */
 bool page_lazy_load (struct file *file, off_t ofs, uint8_t *upage, 
                      uint32_t read_bytes, uint32_t zero_bytes,
                      bool writable, int type)
 {
-  /* Proceed until both read_bytes and zero_bytes become 0 */
-  while (read_bytes > 0 || zero_bytes > 0) 
-  {
-    /* Actual read bytes cannont exceed PGSIZE, the rest should be filled with 0 */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
+  ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+  ASSERT (pg_ofs (upage) == 0);
 
-    struct suppl_page_table_entry *spte = malloc (sizeof (struct suppl_page_table_entry));
-    if (spte == NULL){
-      return false;
-    }
-    /* Initialize spte */
-    spte->type = type;
-    spte->file = file;
-    spte->offset = ofs;
-    spte->addr = upage;
-    spte->read_bytes = page_read_bytes;
-    spte->zero_bytes = page_zero_bytes;
-    spte->writable = writable;
-    spte->timestamp = timer_ticks();
-    spte->free = true;
-    lock_init(&spte->spte_lock);
-
-    /* Insert into suppl_page_table */
-    struct thread *t = thread_current();
-    struct hash_elem* old = hash_insert (&t->suppl_page_table, &spte->hash_elem);
-    if (old != NULL)
-    {
-      free (spte);
-      return false;
-    }
+  struct vma *v = vma_alloc ();
+  if (v == NULL)
+    return false;
+  v->start = upage;
+  v->end = upage + read_bytes + zero_bytes;
+  v->file = file;
+  v->offset = ofs;
+  v->read_bytes = read_bytes;
+  v->writable = writable;
+  v->type = type;
 
-    /* Update for next round */
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    upage += PGSIZE;
-    ofs += page_read_bytes;
+  if (!vma_insert (thread_current (), v))
+  {
+    vma_free (v);
+    return false;
   }
   return true;
 }
 
-bool stack_grow (void *fault_addr)
+/* Returns the current process's SPTE for the page containing
+   UPAGE.  If the page has none yet but lies in a VMA, makes one
+   from the VMA.  Returns NULL if the page is not part of the
+   address space, or if out of memory. */
+struct suppl_page_table_entry *
+page_lookup (void *upage)
+{
+  struct thread *cur = thread_current ();
+  struct suppl_page_table_entry *spte;
+  struct vma *v;
+
+  spte = page_hash_find (&cur->suppl_page_table, upage);
+  if (spte != NULL)
+    return spte;
+
+  v = vma_find (cur, upage);
+  if (v == NULL)
+    return NULL;
+
+  spte = slab_alloc (&spte_cache);
+  if (spte == NULL)
+    return NULL;
+
+  /* Actual read bytes cannont exceed PGSIZE, the rest should be
+     filled with 0 */
+  uint32_t page_ofs = (uint8_t *) pg_round_down (upage) - (uint8_t *) v->start;
+  uint32_t left = v->read_bytes > page_ofs ? v->read_bytes - page_ofs : 0;
+
+  /* Initialize spte */
+  spte->type = v->type;
+  spte->file = v->file;
+  spte->offset = v->offset + page_ofs;
+  spte->addr = pg_round_down (upage);
+  spte->read_bytes = left < PGSIZE ? left : PGSIZE;
+  spte->zero_bytes = PGSIZE - spte->read_bytes;
+  spte->writable = v->writable;
+  spte->free = true;
+  spte->swap_idx = SWAP_SLOT_NONE;
+
+  /* Insert into suppl_page_table */
+  hash_insert (&cur->suppl_page_table, &spte->hash_elem);
+  return spte;
+}
+
+/* Adds the page containing FAULT_ADDR to the stack.  If the
+   access was a read (WRITE is false), maps the shared zero page
+   there until the page is written. */
+bool stack_grow (void *fault_addr, bool write)
 {
   ASSERT (fault_addr != NULL);
   
   struct thread *cur = thread_current ();
 
   /* Create a spte */
-  struct suppl_page_table_entry *spte = malloc (sizeof (struct suppl_page_table_entry));
-
-  /* Get an empty frame */
-  void *frame = vm_get_frame (PAL_USER, spte);
-  if (frame == NULL)
-  {
-    free (spte);
+  struct suppl_page_table_entry *spte = slab_alloc (&spte_cache);
+  if (spte == NULL)
     return false;
-  }
   spte->free = false;
   spte->writable = true;
   spte->addr = pg_round_down (fault_addr);
   spte->type = type_swap;
-  spte->timestamp = timer_ticks();
-  lock_init (&spte->spte_lock);
+  spte->swap_idx = SWAP_SLOT_NONE;
 
-  /* Install page */
-  if (!install_page (spte->addr, frame, spte->writable))
+  /* Insert into suppl_page_table */
+  if (hash_insert (&cur->suppl_page_table, &spte->hash_elem))
   {
-    free (spte);
-    vm_free_frame (frame);
+    slab_free (&spte_cache, spte);
     return false;
   }
 
-  /* Insert into suppl_page_table */
-  if (hash_insert (&cur->suppl_page_table, &spte->hash_elem))
+  if (!write && vm_map_zero_page (spte))
+  {
+    cur->vmstat.stack_faults++;
+    return true;
+  }
+
+  /* Get an empty frame */
+  void *frame = vm_get_frame (PAL_USER | PAL_ZERO, spte);
+  if (frame != NULL)
   {
-    free (spte);
+    /* Install page */
+    if (install_page (spte->addr, frame, spte->writable))
+    {
+      cur->vmstat.stack_faults++;
+      return true;
+    }
     vm_free_frame (frame);
+  }
+
+  hash_delete (&cur->suppl_page_table, &spte->hash_elem);
+  slab_free (&spte_cache, spte);
+  return false;
+}
+
+/* Gives CHILD, being forked from PARENT, a copy of each of
+   PARENT's pages but its memory mappings.  Pages in memory are
+   shared copy-on-write (see vm_fork_frame()), and pages in swap
+   share the swap slot, so nothing is copied yet.  Pages PARENT
+   never touched are left to CHILD's copies of its VMAs.  Returns
+   false if out of memory. */
+bool
+page_fork (struct thread *parent, struct thread *child)
+{
+  struct hash_iterator i;
+
+  if (!vma_fork (parent, child))
     return false;
+
+  hash_first (&i, &parent->suppl_page_table);
+  while (hash_next (&i))
+  {
+    struct suppl_page_table_entry *pspte
+      = hash_entry (hash_cur (&i), struct suppl_page_table_entry, hash_elem);
+    bool success = true;
+
+    if (pspte->type == type_mmap)
+      continue;
+
+    struct suppl_page_table_entry *cspte = slab_alloc (&spte_cache);
+    if (cspte == NULL)
+      return false;
+
+    /* Hold PSPTE's lock, so that the page stays where it is */
+    lock_acquire (&pspte->spte_lock);
+    cspte->type = pspte->type;
+    cspte->file = pspte->file == parent->running_file
+                  ? child->running_file : pspte->file;
+    cspte->offset = pspte->offset;
+    cspte->addr = pspte->addr;
+    cspte->read_bytes = pspte->read_bytes;
+    cspte->zero_bytes = pspte->zero_bytes;
+    cspte->writable = pspte->writable;
+    cspte->free = pspte->free;
+    cspte->swap_idx = SWAP_SLOT_NONE;
+    hash_insert (&child->suppl_page_table, &cspte->hash_elem);
+
+    if (pagedir_get_page (parent->pagedir, pspte->addr) != NULL)
+      success = vm_fork_frame (parent, pspte, child, cspte);
+    else if (pspte->type == type_swap && pspte->swap_idx != SWAP_SLOT_NONE)
+    {
+      swap_dup (pspte->swap_idx);
+      cspte->swap_idx = pspte->swap_idx;
+    }
+    lock_release (&pspte->spte_lock);
+
+    if (!success)
+      return false;
   }
   return true;
 }
 
+/* Brings the page containing UADDR in the current process into
+   memory, if it is not there, and pins its frame so that it stays
+   there until page_unpin().  If WRITE is true, the page is about
+   to be written, so it has to be writable, and gets a copy of its
+   own now if it is copy-on-write.  Returns false if UADDR is not
+   part of the address space (or, with WRITE, not writable), or if
+   out of memory. */
+bool
+page_pin (void *uaddr, bool write)
+{
+  struct thread *cur = thread_current ();
+  struct suppl_page_table_entry *spte = page_lookup (uaddr);
+
+  if (spte == NULL || (write && !spte->writable))
+    return false;
+
+  for (;;)
+  {
+    bool success = true;
+    void *frame;
+
+    /* Holding the SPTE's lock keeps the page from being evicted
+       between finding its frame and pinning it */
+    lock_acquire (&spte->spte_lock);
+    frame = pagedir_get_page (cur->pagedir, spte->addr);
+    if (frame != NULL && write)
+    {
+      success = vm_cow_frame (spte);
+      frame = pagedir_get_page (cur->pagedir, spte->addr);
+    }
+    if (success && frame != NULL)
+      vm_pin_frame (frame);
+    lock_release (&spte->spte_lock);
+
+    if (!success)
+      return false;
+    if (frame != NULL)
+      return true;
+
+    /* Not in memory: fault it in, then try again, in case it has
+       been evicted again already */
+    cur->vmstat.faults++;
+    if (!page_load (spte, write))
+      return false;
+  }
+}
+
+/* Unpins the page containing UADDR in the current process, which
+   page_pin() pinned. */
+void
+page_unpin (void *uaddr)
+{
+  void *frame = pagedir_get_page (thread_current ()->pagedir, uaddr);
+
+  ASSERT (frame != NULL);
+  vm_unpin_frame (frame);
+}
+
+/* Handles a write to SPTE's page where the page is present but
+   read-only.  That is legitimate only for a writable page that
+   fork() left shared, which then gets copied.  Returns false if
+   the write is not allowed or there is no memory to copy. */
+bool
+page_cow (struct suppl_page_table_entry *spte)
+{
+  bool success;
+
+  if (!spte->writable)
+    return false;
+
+  lock_acquire (&spte->spte_lock);
+  success = vm_cow_frame (spte);
+  lock_release (&spte->spte_lock);
+  if (success)
+    thread_current ()->vmstat.cow_faults++;
+  return success;
+}
+
 void
 free_suppl_page_table (struct hash *spte)
 {
@@ -200,5 +607,20 @@ free_suppl_page_table (struct hash *spte)
 void
 free_func (struct hash_elem *e, void *aux UNUSED)
 {
-  free (hash_entry (e, struct suppl_page_table_entry, hash_elem));
+  struct suppl_page_table_entry *spte
+    = hash_entry (e, struct suppl_page_table_entry, hash_elem);
+
+  /* Wait for the pageout daemon, if it is writing the page out */
+  lock_acquire (&spte->spte_lock);
+  lock_release (&spte->spte_lock);
+  if (spte->swap_idx != SWAP_SLOT_NONE)
+    swap_free (spte->swap_idx);
+  page_free_spte (spte);
+}
+
+/* Frees SPTE, which must not be locked or in any page table. */
+void
+page_free_spte (struct suppl_page_table_entry *spte)
+{
+  slab_free (&spte_cache, spte);
 }
\ No newline at end of file
@@ -11,6 +11,10 @@
 #define spte_init(suppl_page_table) hash_init((suppl_page_table), page_hash, page_less, NULL)
 #define STACK_LIMIT (1 << 23)
 
+/* Most pages page_load_file() reads in after a faulting page. */
+#define FAULT_AROUND_MAX 16
+extern unsigned page_fault_around;
+
 static const int type_mmap = 1;
 static const int type_file = 2;
 static const int type_swap = 3;
@@ -26,21 +30,28 @@ struct suppl_page_table_entry
   bool writable;                /* Whether the page is writable */
   bool free;                    /* False if the page hasn't been loaded */
   size_t swap_idx;              /* Index on swap bitmap returned by swap_out() */
-  int64_t timestamp;            /* Creation and accessing time */
   struct lock spte_lock;        /* Lock in case synchronization */
   struct hash_elem hash_elem;   /* Hash table element */
 };
 
+void page_init (void);
 unsigned page_hash (const struct hash_elem *, void *);
 bool page_less (const struct hash_elem *, const struct hash_elem *, void *);
 
 struct suppl_page_table_entry *page_hash_find (struct hash *, uint8_t *);
+struct suppl_page_table_entry *page_lookup (void *);
+bool page_load (struct suppl_page_table_entry *, bool write);
 bool page_load_file (struct suppl_page_table_entry *);
 bool page_load_swap (struct suppl_page_table_entry *);
 bool page_lazy_load (struct file *f, off_t, uint8_t *, uint32_t, uint32_t, bool, int);
 
-bool stack_grow (void *);
+bool stack_grow (void *, bool write);
+bool page_fork (struct thread *, struct thread *);
+bool page_cow (struct suppl_page_table_entry *);
+bool page_pin (void *, bool write);
+void page_unpin (void *);
 
 void free_suppl_page_table (struct hash *);
+void page_free_spte (struct suppl_page_table_entry *);
 
 #endif
\ No newline at end of file
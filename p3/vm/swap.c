@@ -1,62 +1,371 @@
 #include "swap.h"
 #include <bitmap.h>
+#include <round.h>
+#include <string.h>
 #include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#include "zswap.h"
 
 
 #define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Swap slots are grouped into clusters of SWAP_CLUSTER adjacent
+   slots.  Each process takes slots from a cluster of its own
+   until it is full, then moves to a fresh one, so the pages one
+   process swaps out lie next to each other on disk.  That lets
+   the pageout daemon write several of them with one transfer,
+   and lets a fault on one of them read its neighbours back in the
+   same transfer (swap read-ahead).  Only when no cluster is free
+   are slots taken wherever they can be found.
+
+   A page that zswap (see zswap.c) can keep compressed in memory
+   still gets a slot, which names it, but is not written to the
+   slot unless zswap turns it down. */
+
+/* What occupies a swap slot. */
+struct swap_slot
+{
+  struct suppl_page_table_entry *spte;    /* Page in the slot */
+  struct thread *owner;                   /* Process the page belongs to */
+  size_t zhandle;                         /* Copy in zswap, or ZSWAP_NONE */
+  unsigned ref_cnt;                       /* Number of SPTEs naming the slot */
+};
 
 static struct block* global_swap_block; /* The block of the swap disk */
-static struct bitmap *swap_bitmap;									
+static struct bitmap *swap_bitmap;      /* Slots in use */
+static struct swap_slot *slots;         /* Occupant of each slot */
+static struct bitmap *cluster_bitmap;   /* Clusters in use */
+static struct thread **cluster_owner;   /* Process filling each cluster, or NULL */
+static size_t slot_cnt, cluster_cnt;
 static struct lock swap_lock;
 
+static size_t submit_slots (struct swap_page **, size_t cnt,
+                            struct block_request *, uint8_t **bounce);
+
 
 void
 swap_init ()
 {
+  size_t i;
+
   global_swap_block = block_get_role(BLOCK_SWAP);
   if (global_swap_block == NULL)
     PANIC ("Failed to get swap block!\n");
   
-  swap_bitmap = bitmap_create (block_size (global_swap_block) / SECTORS_PER_PAGE);
-  if (swap_bitmap == NULL)
+  slot_cnt = block_size (global_swap_block) / SECTORS_PER_PAGE;
+  cluster_cnt = slot_cnt / SWAP_CLUSTER;
+  swap_bitmap = bitmap_create (slot_cnt);
+  cluster_bitmap = bitmap_create (cluster_cnt);
+  if (swap_bitmap == NULL || cluster_bitmap == NULL)
     PANIC ("Failed to create bitmap!\n");
+  slots = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                               DIV_ROUND_UP (slot_cnt * sizeof *slots, PGSIZE));
+  cluster_owner = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                       DIV_ROUND_UP (cluster_cnt * sizeof *cluster_owner, PGSIZE));
   
   bitmap_set_all (swap_bitmap, false);
+  for (i = 0; i < slot_cnt; i++)
+    slots[i].zhandle = ZSWAP_NONE;
   lock_init (&swap_lock);
+  zswap_init ();
+}
+
+/* Returns true if cluster C has no slot in use. */
+static bool
+cluster_empty (size_t c)
+{
+  return !bitmap_any (swap_bitmap, c * SWAP_CLUSTER, SWAP_CLUSTER);
+}
+
+/* Stops T filling its current cluster, releasing the cluster if
+   it holds nothing.  Must be called with swap_lock held. */
+static void
+leave_cluster (struct thread *t)
+{
+  size_t c = t->swap_cluster;
+
+  if (c == SIZE_MAX)
+    return;
+  cluster_owner[c] = NULL;
+  if (cluster_empty (c))
+    bitmap_reset (cluster_bitmap, c);
+  t->swap_cluster = SIZE_MAX;
+}
+
+/* Allocates a slot for SPTE, a page of OWNER, from OWNER's
+   cluster if possible.  Panics if swap is full.  Must be called
+   with swap_lock held. */
+static size_t
+alloc_slot (struct suppl_page_table_entry *spte, struct thread *owner)
+{
+  size_t slot = BITMAP_ERROR;
+  size_t c;
+
+  for (;;)
+  {
+    c = owner->swap_cluster;
+    if (c != SIZE_MAX)
+    {
+      slot = bitmap_scan (swap_bitmap, c * SWAP_CLUSTER, 1, false);
+      if (slot < (c + 1) * SWAP_CLUSTER)
+        break;
+      leave_cluster (owner);
+    }
+
+    /* Start a fresh cluster */
+    c = bitmap_scan_and_flip (cluster_bitmap, 0, 1, false);
+    if (c == BITMAP_ERROR)
+    {
+      /* None left: take any free slot */
+      slot = bitmap_scan (swap_bitmap, 0, 1, false);
+      if (slot == BITMAP_ERROR)
+        PANIC ("Swap is full!\n");
+      break;
+    }
+    owner->swap_cluster = c;
+    cluster_owner[c] = owner;
+  }
+
+  bitmap_mark (swap_bitmap, slot);
+  slots[slot].spte = spte;
+  slots[slot].owner = owner;
+  slots[slot].zhandle = ZSWAP_NONE;
+  slots[slot].ref_cnt = 1;
+  return slot;
+}
+
+/* Adds a reference to slot SLOT, for another process that shares
+   the page in it after fork().  A shared slot is not read ahead:
+   it no longer belongs to one process. */
+void
+swap_dup (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_bitmap, slot));
+  slots[slot].ref_cnt++;
+  slots[slot].spte = NULL;
+  slots[slot].owner = NULL;
+  lock_release (&swap_lock);
 }
 
+/* Drops a reference to slot SLOT, freeing it if that was the last
+   one. */
+void
+swap_free (size_t slot)
+{
+  size_t c = slot / SWAP_CLUSTER;
+
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_bitmap, slot));
+  if (--slots[slot].ref_cnt > 0)
+  {
+    lock_release (&swap_lock);
+    return;
+  }
+  bitmap_reset (swap_bitmap, slot);
+  slots[slot].spte = NULL;
+  slots[slot].owner = NULL;
+  if (slots[slot].zhandle != ZSWAP_NONE)
+    zswap_free (slots[slot].zhandle);
+  if (c < cluster_cnt && cluster_owner[c] == NULL && cluster_empty (c))
+    bitmap_reset (cluster_bitmap, c);
+  lock_release (&swap_lock);
+}
+
+/* Releases T's current cluster.  Called when T exits, after its
+   pages' slots have been freed. */
+void
+swap_release_cluster (struct thread *t)
+{
+  lock_acquire (&swap_lock);
+  leave_cluster (t);
+  lock_release (&swap_lock);
+}
+
+/* Reads the page in slot SWAP_INDEX into PAGE and drops the
+   caller's reference to the slot. */
 void
 swap_in (void * page, size_t swap_index){
-  read_from_block(page, swap_index);
-  bitmap_flip (swap_bitmap, swap_index);
+  swap_read (page, swap_index, 1);
+  swap_free (swap_index);
 }
 
+/* Writes PAGE, the contents of SPTE's page in OWNER, to a free
+   slot and returns the slot. */
 size_t
-swap_out (void * page){
+swap_out (void * page, struct suppl_page_table_entry *spte, struct thread *owner){
+  struct swap_page p;
+
+  p.frame = page;
+  p.spte = spte;
+  p.owner = owner;
+  swap_out_batch (&p, 1);
+  return p.slot;
+}
+
+/* Writes the CNT pages in PAGES to swap, storing the slot used
+   for each into its SLOT member.  Pages that zswap takes are not
+   written at all.  Pages of one process go into adjacent slots
+   where possible, and each run of adjacent slots is written with
+   a single transfer.  The transfers are all queued on the swap
+   device before waiting for any, so the elevator can order them,
+   and the swap disk works on them while other devices serve
+   other threads. */
+void
+swap_out_batch (struct swap_page *pages, size_t cnt)
+{
+  struct swap_page *sorted[SWAP_CLUSTER];
+  struct block_request reqs[SWAP_CLUSTER];
+  uint8_t *bounce[SWAP_CLUSTER];
+  size_t i, j, run, disk_cnt, req_cnt;
+
+  while (cnt > SWAP_CLUSTER)
+  {
+    swap_out_batch (pages, SWAP_CLUSTER);
+    pages += SWAP_CLUSTER;
+    cnt -= SWAP_CLUSTER;
+  }
+
   lock_acquire (&swap_lock);
-  size_t swap_index = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  for (i = 0; i < cnt; i++)
+    pages[i].slot = alloc_slot (pages[i].spte, pages[i].owner);
   lock_release (&swap_lock);
-  write_from_block(page, swap_index);
-  return swap_index;
+
+  /* Sort the pages zswap does not take by slot (insertion sort;
+     CNT is small) */
+  disk_cnt = 0;
+  for (i = 0; i < cnt; i++)
+  {
+    size_t zhandle;
+
+    if (zswap_store (pages[i].frame, &zhandle))
+    {
+      lock_acquire (&swap_lock);
+      slots[pages[i].slot].zhandle = zhandle;
+      lock_release (&swap_lock);
+      continue;
+    }
+    for (j = disk_cnt++; j > 0 && sorted[j - 1]->slot > pages[i].slot; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = &pages[i];
+  }
+
+  /* Submit each run of adjacent slots, then wait for them all */
+  req_cnt = 0;
+  for (i = 0; i < disk_cnt; i += run)
+  {
+    for (run = 1; i + run < disk_cnt; run++)
+      if (sorted[i + run]->slot != sorted[i]->slot + run)
+        break;
+    req_cnt += submit_slots (sorted + i, run, reqs + req_cnt,
+                             bounce + req_cnt);
+  }
+  for (i = 0; i < req_cnt; i++)
+  {
+    block_wait (&reqs[i]);
+    if (bounce[i] != NULL)
+      palloc_free_multiple (bounce[i], reqs[i].cnt / SECTORS_PER_PAGE);
+  }
 }
 
-void
-read_from_block(void* frame, int index){
-  for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
+/* Submits writes of the CNT pages in PAGES, whose slots are
+   adjacent, using requests from REQS: one transfer through a
+   bounce buffer, or one per page if there is no memory for one.
+   Stores the bounce buffer, if any, for each request into BOUNCE,
+   to be freed once it completes.  Returns the number of requests
+   submitted. */
+static size_t
+submit_slots (struct swap_page **pages, size_t cnt,
+              struct block_request *reqs, uint8_t **bounce)
+{
+  uint8_t *buffer = cnt > 1 ? palloc_get_multiple (0, cnt) : NULL;
+  size_t i;
+
+  if (buffer == NULL)
   {
-    block_read (global_swap_block, index * SECTORS_PER_PAGE + i,
-                frame + i * BLOCK_SECTOR_SIZE);
+    for (i = 0; i < cnt; i++)
+    {
+      bounce[i] = NULL;
+      block_request_init (&reqs[i], true, pages[i]->slot * SECTORS_PER_PAGE,
+                          SECTORS_PER_PAGE, pages[i]->frame, NULL, NULL);
+      block_submit (global_swap_block, &reqs[i]);
+    }
+    return cnt;
   }
+
+  for (i = 0; i < cnt; i++)
+    memcpy (buffer + i * PGSIZE, pages[i]->frame, PGSIZE);
+  bounce[0] = buffer;
+  block_request_init (&reqs[0], true, pages[0]->slot * SECTORS_PER_PAGE,
+                      cnt * SECTORS_PER_PAGE, buffer, NULL, NULL);
+  block_submit (global_swap_block, &reqs[0]);
+  return 1;
 }
 
+/* Reads the CNT slots starting at FIRST into BUFFER, taking the
+   pages zswap holds from there and reading each run of the rest
+   with one transfer.  Does not free them. */
 void
-write_from_block(void* frame, int index){
-  for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
+swap_read (void *buffer, size_t first, size_t cnt)
+{
+  uint8_t *page = buffer;
+  size_t i, run;
+  bool on_disk;
+
+  ASSERT (first + cnt <= slot_cnt);
+
+  for (i = 0; i < cnt; i += run)
   {
-    block_write (global_swap_block, index * SECTORS_PER_PAGE + i,
-                frame + i * BLOCK_SECTOR_SIZE);
+    /* Find the run of slots not in zswap starting at I */
+    lock_acquire (&swap_lock);
+    for (run = 0; i + run < cnt; run++)
+      if (slots[first + i + run].zhandle != ZSWAP_NONE)
+        break;
+    on_disk = run > 0;
+    if (!on_disk)
+    {
+      zswap_load (slots[first + i].zhandle, page + i * PGSIZE);
+      run = 1;
+    }
+    lock_release (&swap_lock);
+
+    if (on_disk)
+      block_read_multiple (global_swap_block,
+                           (first + i) * SECTORS_PER_PAGE,
+                           run * SECTORS_PER_PAGE, page + i * PGSIZE);
   }
+}
+
+/* Returns the SPTE of the page of OWNER in slot SLOT, or NULL if
+   the slot is free, out of range, or holds another process's
+   page. */
+struct suppl_page_table_entry *
+swap_slot_page (size_t slot, struct thread *owner)
+{
+  struct suppl_page_table_entry *spte = NULL;
+
+  lock_acquire (&swap_lock);
+  if (slot < slot_cnt && slots[slot].owner == owner)
+    spte = slots[slot].spte;
+  lock_release (&swap_lock);
+  return spte;
+}
+
+/* Reads the page in slot INDEX into FRAME with a single
+   multi-sector transfer. */
+void
+read_from_block(void* frame, int index){
+  block_read_multiple (global_swap_block, index * SECTORS_PER_PAGE,
+                       SECTORS_PER_PAGE, frame);
+}
+
+/* Writes FRAME to swap slot INDEX with a single multi-sector
+   transfer. */
+void
+write_from_block(void* frame, int index){
+  block_write_multiple (global_swap_block, index * SECTORS_PER_PAGE,
+                        SECTORS_PER_PAGE, frame);
 }
\ No newline at end of file
@@ -3,10 +3,36 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+struct thread;
+struct suppl_page_table_entry;
+
+/* Swap slots are handed out in clusters of this many adjacent
+   slots; see swap.c. */
+#define SWAP_CLUSTER 8
+
+/* Value of an SPTE's swap_idx while the page is not in swap. */
+#define SWAP_SLOT_NONE SIZE_MAX
+
+/* A page to be written by swap_out_batch(). */
+struct swap_page
+{
+  void *frame;                            /* Page contents */
+  struct suppl_page_table_entry *spte;    /* The page's SPTE */
+  struct thread *owner;                   /* Process the page belongs to */
+  size_t slot;                            /* Set to the slot used */
+};
 
 void swap_init (void);
 void swap_in (void *, size_t);
-size_t swap_out (void *);
+size_t swap_out (void *, struct suppl_page_table_entry *, struct thread *);
+void swap_out_batch (struct swap_page *, size_t cnt);
+void swap_read (void *, size_t first, size_t cnt);
+struct suppl_page_table_entry *swap_slot_page (size_t, struct thread *);
+void swap_dup (size_t);
+void swap_free (size_t);
+void swap_release_cluster (struct thread *);
 
 void read_from_block(void*, int);
 void write_from_block(void*, int);
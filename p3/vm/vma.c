@@ -0,0 +1,119 @@
+#include "vma.h"
+#include <debug.h>
+#include "page.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+
+/* A process's VMAs are kept in its vma_list sorted by address.
+   A process has only a handful of them (text, data, and one per
+   memory mapping), so a list is plenty. */
+
+static struct slab_cache vma_cache;
+
+/* Initializes the VMA cache. */
+void
+vma_init (void)
+{
+  slab_cache_init (&vma_cache, "vma", sizeof (struct vma), NULL);
+}
+
+/* Returns a new, uninitialized VMA, or NULL if out of memory. */
+struct vma *
+vma_alloc (void)
+{
+  return slab_alloc (&vma_cache);
+}
+
+/* Frees V, which must not be in any vma_list. */
+void
+vma_free (struct vma *v)
+{
+  slab_free (&vma_cache, v);
+}
+
+/* Adds V to T's address space.  Returns false, without adding it,
+   if it overlaps a VMA T already has. */
+bool
+vma_insert (struct thread *t, struct vma *v)
+{
+  struct list_elem *e;
+
+  ASSERT (v->start < v->end);
+
+  for (e = list_begin (&t->vma_list); e != list_end (&t->vma_list);
+       e = list_next (e))
+  {
+    struct vma *o = list_entry (e, struct vma, elem);
+    if (o->start >= v->end)
+      break;
+    if (o->end > v->start)
+      return false;
+  }
+  list_insert (e, &v->elem);
+  return true;
+}
+
+/* Returns T's VMA that contains ADDR, or NULL if there is none. */
+struct vma *
+vma_find (struct thread *t, const void *addr)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&t->vma_list); e != list_end (&t->vma_list);
+       e = list_next (e))
+  {
+    struct vma *v = list_entry (e, struct vma, elem);
+    if (addr < v->start)
+      break;
+    if (addr < v->end)
+      return v;
+  }
+  return NULL;
+}
+
+/* Removes and frees T's VMA that starts at START.  The SPTEs of
+   its pages are the caller's business. */
+void
+vma_remove (struct thread *t, void *start)
+{
+  struct vma *v = vma_find (t, start);
+
+  ASSERT (v != NULL && v->start == start);
+  list_remove (&v->elem);
+  vma_free (v);
+}
+
+/* Gives CHILD, being forked from PARENT, a copy of each of
+   PARENT's VMAs but its memory mappings, loading from CHILD's own
+   copy of the executable.  Returns false if out of memory. */
+bool
+vma_fork (struct thread *parent, struct thread *child)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->vma_list); e != list_end (&parent->vma_list);
+       e = list_next (e))
+  {
+    struct vma *v = list_entry (e, struct vma, elem);
+    struct vma *c;
+
+    if (v->type == type_mmap)
+      continue;
+    c = vma_alloc ();
+    if (c == NULL)
+      return false;
+    *c = *v;
+    if (v->file == parent->running_file)
+      c->file = child->running_file;
+    list_push_back (&child->vma_list, &c->elem);
+  }
+  return true;
+}
+
+/* Frees all the VMAs in VMA_LIST. */
+void
+free_vma_list (struct list *vma_list)
+{
+  while (!list_empty (vma_list))
+    vma_free (list_entry (list_pop_front (vma_list), struct vma, elem));
+}
@@ -0,0 +1,35 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/file.h"
+
+struct thread;
+
+/* A range of a process's address space backed by a file: an
+   executable segment or a memory mapping.  Its pages get SPTEs
+   only once they are first faulted in (see page_lookup()), so
+   setting up a range costs the same however large it is. */
+struct vma
+{
+  void *start;                  /* First page */
+  void *end;                    /* Page after the last one */
+  struct file *file;            /* File to load from */
+  off_t offset;                 /* File offset of START */
+  uint32_t read_bytes;          /* Bytes to read from the file; the rest is zeros */
+  bool writable;                /* Whether the pages are writable */
+  int type;                     /* type_file or type_mmap */
+  struct list_elem elem;        /* Element in the thread's vma_list */
+};
+
+void vma_init (void);
+struct vma *vma_alloc (void);
+void vma_free (struct vma *);
+bool vma_insert (struct thread *, struct vma *);
+struct vma *vma_find (struct thread *, const void *);
+void vma_remove (struct thread *, void *start);
+bool vma_fork (struct thread *parent, struct thread *child);
+void free_vma_list (struct list *);
+
+#endif
@@ -0,0 +1,242 @@
+#include "zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap cache.
+
+   Pages on their way to swap are first compressed into a pool
+   of kernel memory, and only go to the swap device if they do
+   not compress well or the pool has no room left.  A process
+   that runs a little short of memory then swaps its pages out
+   and back in without touching the disk.
+
+   The pool is ZSWAP_PAGES contiguous pages, carved into
+   CHUNK_SIZE-byte chunks.  A compressed page takes a run of
+   adjacent chunks, which the chunk bitmap hands out first-fit;
+   its handle is the number of its first chunk.  The run starts
+   with the compressed length.
+
+   Pages are compressed with a small LZ77 compressor in the style
+   of LZSS: a flag byte says which of the next 8 items are
+   literal bytes and which are matches, and a match is a 12-bit
+   offset back into the page and a 4-bit length, with one extra
+   length byte for long matches.  It finds matches through a hash
+   of the next 3 bytes, keeping only the last position for each
+   hash value, so it is fast rather than thorough; that is enough
+   for the zero-filled and repetitive data that most pages hold. */
+
+#define ZSWAP_PAGES 32                  /* Size of the pool in pages */
+#define CHUNK_SIZE 64                   /* Pool allocation unit */
+#define CHUNK_CNT (ZSWAP_PAGES * PGSIZE / CHUNK_SIZE)
+
+/* Pages that do not compress to half their size go to disk:
+   keeping them in the pool would not save much memory. */
+#define MAX_STORED (PGSIZE / 2)
+
+/* Compressor parameters. */
+#define MIN_MATCH 3                     /* Shortest match encoded */
+#define MAX_MATCH (MIN_MATCH + 15 + 255)        /* Longest match */
+#define HASH_BITS 10                    /* Match finder table size */
+#define NO_POS 0xffff                   /* Empty match finder slot */
+
+static uint8_t *pool;                   /* The pool, NULL if disabled */
+static struct bitmap *chunk_map;        /* Chunks in use */
+static struct lock zswap_lock;          /* Protects all of the above */
+
+/* Compressor scratch space.  Protected by zswap_lock; too large
+   for a kernel stack. */
+static uint16_t hash_table[1 << HASH_BITS];
+static uint8_t scratch[MAX_STORED];
+
+static size_t lz_compress (const uint8_t *, uint8_t *, size_t limit);
+static void lz_decompress (const uint8_t *, uint8_t *);
+
+/* Allocates the pool.  If memory is short, runs without it, so
+   that every swapped page goes to disk. */
+void
+zswap_init (void)
+{
+  lock_init (&zswap_lock);
+  pool = palloc_get_multiple (0, ZSWAP_PAGES);
+  chunk_map = bitmap_create (CHUNK_CNT);
+  if (pool == NULL || chunk_map == NULL)
+    {
+      printf ("zswap: not enough memory, disabled\n");
+      if (pool != NULL)
+        palloc_free_multiple (pool, ZSWAP_PAGES);
+      pool = NULL;
+    }
+}
+
+/* Tries to store a compressed copy of PAGE in the pool.  On
+   success, stores its handle into *HANDLE and returns true.
+   Returns false if PAGE does not compress well enough or the
+   pool is full. */
+bool
+zswap_store (const void *page, size_t *handle)
+{
+  uint16_t size;
+  size_t chunk;
+  bool success = false;
+
+  if (pool == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  size = lz_compress (page, scratch, MAX_STORED - sizeof size);
+  if (size != 0)
+    {
+      size_t chunk_cnt = DIV_ROUND_UP (sizeof size + size, CHUNK_SIZE);
+      chunk = bitmap_scan_and_flip (chunk_map, 0, chunk_cnt, false);
+      if (chunk != BITMAP_ERROR)
+        {
+          uint8_t *p = pool + chunk * CHUNK_SIZE;
+          memcpy (p, &size, sizeof size);
+          memcpy (p + sizeof size, scratch, size);
+          *handle = chunk;
+          success = true;
+        }
+    }
+  lock_release (&zswap_lock);
+  return success;
+}
+
+/* Decompresses the page with the given HANDLE into PAGE.  The
+   pool keeps its copy until zswap_free(). */
+void
+zswap_load (size_t handle, void *page)
+{
+  ASSERT (pool != NULL && handle < CHUNK_CNT);
+
+  lock_acquire (&zswap_lock);
+  lz_decompress (pool + handle * CHUNK_SIZE + sizeof (uint16_t), page);
+  lock_release (&zswap_lock);
+}
+
+/* Frees the pool space of the page with the given HANDLE. */
+void
+zswap_free (size_t handle)
+{
+  uint16_t size;
+
+  ASSERT (pool != NULL && handle < CHUNK_CNT);
+
+  lock_acquire (&zswap_lock);
+  memcpy (&size, pool + handle * CHUNK_SIZE, sizeof size);
+  bitmap_set_multiple (chunk_map, handle,
+                       DIV_ROUND_UP (sizeof size + size, CHUNK_SIZE), false);
+  lock_release (&zswap_lock);
+}
+
+/* Returns the match finder's hash of the 3 bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t x = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Compresses the page SRC into DST, which has room for LIMIT
+   bytes.  Returns the compressed size, or 0 if it would exceed
+   LIMIT. */
+static size_t
+lz_compress (const uint8_t *src, uint8_t *dst, size_t limit)
+{
+  size_t ip = 0, op = 0, flag_pos = 0;
+  int flag_bit = 8;
+
+  memset (hash_table, 0xff, sizeof hash_table);
+  while (ip < PGSIZE)
+    {
+      size_t len = 0, off = 0;
+
+      if (flag_bit == 8)
+        {
+          if (op >= limit)
+            return 0;
+          flag_pos = op++;
+          dst[flag_pos] = 0;
+          flag_bit = 0;
+        }
+
+      /* Look for a match. */
+      if (ip + MIN_MATCH <= PGSIZE)
+        {
+          unsigned h = hash3 (src + ip);
+          size_t cand = hash_table[h];
+
+          hash_table[h] = ip;
+          if (cand != NO_POS && !memcmp (src + cand, src + ip, MIN_MATCH))
+            {
+              off = ip - cand;
+              len = MIN_MATCH;
+              while (len < MAX_MATCH && ip + len < PGSIZE
+                     && src[cand + len] == src[ip + len])
+                len++;
+            }
+        }
+
+      if (len != 0)
+        {
+          /* Offset is at most PGSIZE - 1, so it fits in 12 bits. */
+          if (op + 3 > limit)
+            return 0;
+          dst[flag_pos] |= 1 << flag_bit;
+          dst[op++] = off >> 4;
+          if (len - MIN_MATCH < 15)
+            dst[op++] = ((off & 0xf) << 4) | (len - MIN_MATCH);
+          else
+            {
+              dst[op++] = ((off & 0xf) << 4) | 15;
+              dst[op++] = len - MIN_MATCH - 15;
+            }
+          ip += len;
+        }
+      else
+        {
+          if (op >= limit)
+            return 0;
+          dst[op++] = src[ip++];
+        }
+      flag_bit++;
+    }
+  return op;
+}
+
+/* Decompresses SRC, produced by lz_compress(), into the page
+   DST. */
+static void
+lz_decompress (const uint8_t *src, uint8_t *dst)
+{
+  size_t ip = 0, op = 0;
+
+  while (op < PGSIZE)
+    {
+      uint8_t flags = src[ip++];
+      int bit;
+
+      for (bit = 0; bit < 8 && op < PGSIZE; bit++)
+        if (flags & (1 << bit))
+          {
+            size_t off = (src[ip] << 4) | (src[ip + 1] >> 4);
+            size_t len = (src[ip + 1] & 0xf) + MIN_MATCH;
+
+            ip += 2;
+            if (len == MIN_MATCH + 15)
+              len += src[ip++];
+            ASSERT (off != 0 && off <= op && op + len <= PGSIZE);
+
+            /* Byte by byte: the source may overlap the target. */
+            for (; len > 0; len--, op++)
+              dst[op] = dst[op - off];
+          }
+        else
+          dst[op++] = src[ip++];
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Handle of a page held by zswap, or ZSWAP_NONE for none. */
+#define ZSWAP_NONE SIZE_MAX
+
+void zswap_init (void);
+bool zswap_store (const void *page, size_t *handle);
+void zswap_load (size_t handle, void *page);
+void zswap_free (size_t handle);
+
+#endif
@@ -3,7 +3,42 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Requests are queued per device and handed to the driver, one
+   at a time, by a dispatcher thread that picks the next request
+   with the C-LOOK elevator: the lowest sector at or beyond the
+   end of the previous request, wrapping around to the lowest
+   sector in the queue when nothing lies ahead.  A request that
+   has waited past its deadline is dispatched first regardless,
+   so that a stream of requests near the head cannot starve one
+   far away.  Reads get a shorter deadline than writes because a
+   thread is usually waiting on them. */
+#define READ_EXPIRE (TIMER_FREQ / 2)    /* Read deadline, in ticks. */
+#define WRITE_EXPIRE (5 * TIMER_FREQ)   /* Write deadline, in ticks. */
+
+/* Each device keeps a histogram of request latencies, from
+   submission to completion, measured in CPU cycles.  Bucket I
+   counts requests that took from 2**I up to 2**(I+1) cycles;
+   the last bucket also takes anything slower. */
+#define LATENCY_BUCKETS 40
+
+/* Number of recent requests remembered in the trace. */
+#define TRACE_CNT 32
+
+/* Statistics on the requests a device has carried out. */
+struct request_stats
+  {
+    unsigned long long done_cnt;        /* Requests completed. */
+    unsigned long long latency_sum;     /* Total latency in cycles. */
+    unsigned latency_hist[LATENCY_BUCKETS]; /* Latency histogram. */
+    unsigned long long depth_sum;       /* Total of requests' depths. */
+    unsigned depth;                     /* Requests now in flight. */
+    unsigned max_depth;                 /* Most ever in flight. */
+  };
 
 /* A block device. */
 struct block
@@ -19,8 +54,42 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, unless the driver supplies its own submit. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct list queue;                  /* Pending block_requests. */
+    struct condition queue_nonempty;    /* Signaled on new requests. */
+    block_sector_t head;                /* End of last dispatched request. */
+
+    /* Requests carried out by this device, protected by
+       disabling interrupts. */
+    struct request_stats stats;
+  };
+
+/* A request in the trace of recent requests. */
+struct trace_entry
+  {
+    unsigned seq;                       /* Sequence number, 0 if unused. */
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    bool write;                         /* Write if true, else read. */
+    tid_t tid;                          /* Submitting thread. */
+    char thread_name[16];               /* Submitting thread's name. */
+    int64_t ticks;                      /* timer_ticks() at submission. */
+    uint64_t latency;                   /* Cycles to complete, 0 if not yet. */
   };
 
+/* The last TRACE_CNT requests submitted, indexed by sequence
+   number modulo TRACE_CNT.  Protected by disabling interrupts. */
+static struct trace_entry trace[TRACE_CNT];
+static unsigned trace_seq;
+
+/* Timer ticks and CPU cycles when the first device registered,
+   for converting cycles to microseconds. */
+static int64_t start_ticks;
+static uint64_t start_cycles;
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -28,6 +97,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func block_dispatch NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +183,178 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  if (cnt - 1 > block->size - 1 - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", count=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt, block->size);
+}
+
+/* Initializes REQ as a request to read (if WRITE is false) or
+   write (if WRITE is true) the CNT sectors starting at SECTOR,
+   using BUFFER, which must have room for or contain
+   CNT * BLOCK_SECTOR_SIZE bytes.
+
+   If COMPLETE is non-null, it is called with REQ once the
+   transfer has finished, in thread context (never from an
+   interrupt handler); after that the block layer no longer
+   touches REQ, so COMPLETE may free it, and block_wait() must
+   not be used on it.
+   COMPLETE must not wait for another request on the same device.
+   If COMPLETE is null, the submitter calls block_wait(). */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_complete_func *complete, void *aux)
+{
+  ASSERT (req != NULL);
+  ASSERT (cnt > 0);
+
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->complete = complete;
+  req->aux = aux;
+  sema_init (&req->done, 0);
+  req->block = NULL;
+}
+
+/* Returns the trace entry for sequence number SEQ, or a null
+   pointer if it has been overwritten.  Interrupts must be off. */
+static struct trace_entry *
+trace_find (unsigned seq)
+{
+  struct trace_entry *t = &trace[seq % TRACE_CNT];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  return t->seq == seq ? t : NULL;
+}
+
+/* Accounts for REQ entering BLOCK.  A request that a partition
+   passes on to its disk is moved to the disk, so that latency and
+   queue depth are charged to the device that carries it out. */
+static void
+stats_submit (struct block *block, struct block_request *req)
+{
+  enum intr_level old_level = intr_disable ();
+  struct trace_entry *t;
+
+  if (req->block == NULL)
+    {
+      req->start = timer_cycles ();
+      req->trace_seq = ++trace_seq;
+      if (req->trace_seq == 0)
+        req->trace_seq = ++trace_seq;
+
+      t = &trace[req->trace_seq % TRACE_CNT];
+      t->seq = req->trace_seq;
+      t->write = req->write;
+      t->cnt = req->cnt;
+      t->tid = thread_tid ();
+      strlcpy (t->thread_name, thread_name (), sizeof t->thread_name);
+      t->ticks = timer_ticks ();
+      t->latency = 0;
+    }
+  else
+    req->block->stats.depth--;
+
+  t = trace_find (req->trace_seq);
+  if (t != NULL)
+    {
+      t->block = block;
+      t->sector = req->sector;
+    }
+
+  req->block = block;
+  req->depth = block->stats.depth++;
+  if (block->stats.depth > block->stats.max_depth)
+    block->stats.max_depth = block->stats.depth;
+  intr_set_level (old_level);
+}
+
+/* Accounts for the completion of REQ. */
+static void
+stats_complete (struct block_request *req)
+{
+  uint64_t latency = timer_cycles () - req->start;
+  struct request_stats *stats = &req->block->stats;
+  enum intr_level old_level;
+  struct trace_entry *t;
+  uint64_t x;
+  int bucket;
+
+  bucket = 0;
+  for (x = latency; x > 1 && bucket < LATENCY_BUCKETS - 1; x >>= 1)
+    bucket++;
+
+  old_level = intr_disable ();
+  stats->depth--;
+  stats->done_cnt++;
+  stats->depth_sum += req->depth;
+  stats->latency_sum += latency;
+  stats->latency_hist[bucket]++;
+  t = trace_find (req->trace_seq);
+  if (t != NULL)
+    t->latency = latency > 0 ? latency : 1;
+  intr_set_level (old_level);
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  The
+   block layer may reorder queued requests, so a caller that
+   needs one transfer to precede another must wait for the first
+   before submitting the second. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  check_sectors (block, req->sector, req->cnt);
+  if (req->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += req->cnt;
+    }
+  else
+    block->read_cnt += req->cnt;
+  stats_submit (block, req);
+
+  if (block->ops->submit != NULL)
+    {
+      block->ops->submit (block->aux, req);
+      return;
+    }
+
+  req->deadline = timer_ticks () + (req->write ? WRITE_EXPIRE : READ_EXPIRE);
+  lock_acquire (&block->queue_lock);
+  list_push_back (&block->queue, &req->elem);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for REQ, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *req)
+{
+  ASSERT (req->complete == NULL);
+  sema_down (&req->done);
+}
+
+/* Called by the block layer or a driver when REQ has finished. */
+void
+block_complete (struct block_request *req)
+{
+  stats_complete (req);
+  if (req->complete != NULL)
+    req->complete (req);
+  else
+    sema_up (&req->done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +362,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +373,120 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for
+   CNT * BLOCK_SECTOR_SIZE bytes.  Drivers that support it move
+   the whole range with as few device commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request req;
+
+  block_request_init (&req, false, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to
+   BLOCK from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE
+   bytes.  Returns after the block device has acknowledged
+   receiving all of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request req;
+
+  block_request_init (&req, true, sector, cnt, (void *) buffer, NULL, NULL);
+  block_submit (block, &req);
+  block_wait (&req);
+}
+
+/* Chooses the request in BLOCK's queue, which must not be empty,
+   to dispatch next, and removes it from the queue.  See the
+   comment at the top of the file for the policy. */
+static struct block_request *
+elevator_next (struct block *block)
+{
+  struct block_request *expired = NULL, *ahead = NULL, *lowest = NULL;
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  ASSERT (!list_empty (&block->queue));
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+
+      if (r->deadline <= now
+          && (expired == NULL || r->deadline < expired->deadline))
+        expired = r;
+      if (r->sector >= block->head
+          && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+    }
+
+  if (expired != NULL)
+    ahead = expired;
+  else if (ahead == NULL)
+    ahead = lowest;
+  list_remove (&ahead->elem);
+  return ahead;
+}
+
+/* Carries out REQ on BLOCK by calling the driver. */
+static void
+block_transfer (struct block *block, struct block_request *req)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = req->buffer;
+  size_t i;
+
+  if (req->write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, req->sector, req->cnt, p);
+  else if (!req->write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, req->sector, req->cnt, p);
+  else
+    for (i = 0; i < req->cnt; i++)
+      if (req->write)
+        ops->write (block->aux, req->sector + i, p + i * BLOCK_SECTOR_SIZE);
+      else
+        ops->read (block->aux, req->sector + i, p + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Dispatcher thread for BLOCK_: hands queued requests to the
+   driver one at a time, in elevator order, and completes them. */
+static void
+block_dispatch (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *req;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      req = elevator_next (block);
+      block->head = req->sector + req->cnt;
+      lock_release (&block->queue_lock);
+
+      block_transfer (block, req);
+      block_complete (req);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +510,105 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Returns the number of CPU cycles per microsecond, estimated
+   from the time since the first device registered, or 0 if too
+   little time has passed to tell. */
+static uint64_t
+cycles_per_usec (void)
+{
+  int64_t ticks = timer_elapsed (start_ticks);
+
+  if (ticks < TIMER_FREQ / 10)
+    return 0;
+  return ((timer_cycles () - start_cycles)
+          / (ticks * (1000000 / TIMER_FREQ)));
+}
+
+/* Prints "N us", or "N cycles" if CYCLES_PER_USEC is 0, for
+   CYCLES cycles. */
+static void
+print_latency (uint64_t cycles, uint64_t cycles_per_usec)
+{
+  if (cycles_per_usec != 0)
+    printf ("%llu us", (unsigned long long) (cycles / cycles_per_usec));
+  else
+    printf ("%llu cycles", (unsigned long long) cycles);
+}
+
+/* Prints BLOCK's request latency histogram and queue depth,
+   if it has completed any requests. */
+static void
+print_latency_stats (struct block *block, uint64_t cycles_per_usec)
+{
+  struct request_stats stats;
+  enum intr_level old_level;
+  int i;
+
+  old_level = intr_disable ();
+  stats = block->stats;
+  intr_set_level (old_level);
+
+  if (stats.done_cnt == 0)
+    return;
+
+  printf ("%s: %llu requests, mean latency ", block->name, stats.done_cnt);
+  print_latency (stats.latency_sum / stats.done_cnt, cycles_per_usec);
+  printf (", queue depth mean %llu.%llu max %u\n",
+          stats.depth_sum / stats.done_cnt,
+          stats.depth_sum * 10 / stats.done_cnt % 10, stats.max_depth);
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (stats.latency_hist[i] != 0)
+      {
+        printf ("  ");
+        print_latency ((uint64_t) 1 << i, cycles_per_usec);
+        printf (i < LATENCY_BUCKETS - 1 ? " to " : " or more");
+        if (i < LATENCY_BUCKETS - 1)
+          print_latency ((uint64_t) 2 << i, cycles_per_usec);
+        printf (": %u\n", stats.latency_hist[i]);
+      }
+}
+
+/* Prints the requests in the trace, oldest first. */
+static void
+print_trace (uint64_t cycles_per_usec)
+{
+  unsigned seq;
+
+  printf ("Recent block requests:\n");
+  for (seq = trace_seq > TRACE_CNT ? trace_seq - TRACE_CNT + 1 : 1;
+       seq != trace_seq + 1; seq++)
+    {
+      struct trace_entry t;
+      enum intr_level old_level;
+      bool found;
+
+      old_level = intr_disable ();
+      found = trace_find (seq) != NULL;
+      if (found)
+        t = *trace_find (seq);
+      intr_set_level (old_level);
+      if (!found)
+        continue;
+
+      printf ("  %lld: %s %s %"PRDSNu"+%zu by %s (tid %d), ",
+              t.ticks, t.block->name, t.write ? "write" : "read",
+              t.sector, t.cnt, t.thread_name, t.tid);
+      if (t.latency != 0)
+        print_latency (t.latency, cycles_per_usec);
+      else
+        printf ("pending");
+      printf ("\n");
+    }
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role, then latency and queue depth for each device that has
+   carried out requests, then the most recent requests. */
 void
 block_print_stats (void)
 {
+  uint64_t cpu = cycles_per_usec ();
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -176,13 +621,21 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    print_latency_stats (list_entry (e, struct block, list_elem), cpu);
+
+  if (trace_seq != 0)
+    print_trace (cpu);
 }
 
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
    be provided, as well as the it operation functions OPS, which
-   will be passed AUX in each function call. */
+   will be passed AUX in each function call.  Unless OPS provides
+   submit, starts a thread to dispatch BLOCK's requests. */
 struct block *
 block_register (const char *name, enum block_type type,
                 const char *extra_info, block_sector_t size,
@@ -200,6 +653,16 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  cond_init (&block->queue_nonempty);
+  block->head = 0;
+  if (start_ticks == 0)
+    {
+      start_ticks = timer_ticks ();
+      start_cycles = timer_cycles ();
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -208,6 +671,16 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  if (ops->submit == NULL)
+    {
+      char thread_name[16];
+
+      snprintf (thread_name, sizeof thread_name, "%.12s-io", block->name);
+      if (thread_create (thread_name, PRI_DEFAULT, block_dispatch, block)
+          == TID_ERROR)
+        PANIC ("%s: failed to start dispatcher thread", block->name);
+    }
+
   return block;
 }
 
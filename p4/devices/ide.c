@@ -3,15 +3,27 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the IDE controller is a PCI bus master (as is the PIIX
+   that QEMU and Bochs emulate), disk transfers use DMA as
+   described in [SFF-8038i]: the driver hands the controller a
+   table of physical memory regions, starts the command, and
+   sleeps until the completion interrupt, leaving the CPU free
+   to run other threads for the whole transfer.  Otherwise, or
+   for buffers that DMA cannot reach, it falls back to PIO. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +42,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses.  Each channel has its own set
+   of registers within the controller's bus master I/O space. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD Table. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/Stop Bus Master. */
+#define BM_CMD_READ 0x08        /* Direction: 1=device to memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +76,15 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Largest number of sectors one READ or WRITE command can move.
+   A sector count register value of 0 stands for 256. */
+#define MAX_CMD_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,8 +93,24 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per DRQ block for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Use bus master DMA for transfers? */
   };
 
+/* Physical Region Descriptor: one entry in the table that tells
+   the bus master where in physical memory to move data.  A region
+   must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical base address. */
+    uint16_t size;              /* Byte count; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel
@@ -72,6 +124,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O base, or 0 if none. */
+    struct prd *prdt;           /* PRD table, if bm_base is nonzero. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -84,11 +139,16 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *);
+static uint16_t find_bus_master (void);
+static bool can_dma (const struct ata_disk *, const void *, size_t cnt);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          const void *, bool write);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +161,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +187,9 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = (c->bm_base != 0
+                 ? palloc_get_page (PAL_ASSERT | PAL_ZERO) : NULL);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +200,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -279,7 +345,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +369,71 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use multiple-sector DRQ blocks if the disk supports them. */
+  d->multiple = *(uint16_t *) &id[47 * 2] & 0xff;
+  set_multiple_mode (d);
+  if (d->multiple > 0)
+    {
+      size_t len = strlen (extra_info);
+      snprintf (extra_info + len, sizeof extra_info - len,
+                ", %d sectors/block", d->multiple);
+    }
+
+  /* Use DMA if both the controller and the disk support it. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100) != 0;
+  if (d->dma)
+    strlcat (extra_info, ", DMA", sizeof extra_info);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Turns on READ/WRITE MULTIPLE for disk D with D->multiple
+   sectors per DRQ block, the largest block size D reports.
+   Leaves D->multiple at 0 if D does not support multiple mode or
+   rejects the command. */
+static void
+set_multiple_mode (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  if (d->multiple <= 1)
+    {
+      d->multiple = 0;
+      return;
+    }
+
+  select_device_wait (d);
+  outb (reg_nsect (c), d->multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (inb (reg_status (c)) & STA_ERR)
+    d->multiple = 0;
+}
+
+/* Looks for a PCI IDE controller that can act as a bus master
+   and enables it.  Returns the base of its bus master I/O
+   registers, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_dev pci;
+  uint16_t bm_base;
+
+  /* Class 01h (mass storage), subclass 01h (IDE).  Bit 7 of the
+     programming interface says the controller is a bus master. */
+  if (!pci_find_class (0x01, 0x01, &pci) || !(pci.prog_if & 0x80))
+    return 0;
+
+  bm_base = pci_io_bar (&pci, 4);
+  if (bm_base != 0)
+    pci_enable (&pci, PCI_CMD_IO | PCI_CMD_MASTER);
+  return bm_base;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +462,243 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Returns the number of sectors that disk D transfers per
+   interrupt in a command that moves CNT sectors. */
+static size_t
+drq_block_size (const struct ata_disk *d, size_t cnt)
+{
+  return d->multiple > 1 && cnt > 1 ? (size_t) d->multiple : 1;
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Each command moves up to MAX_CMD_SECTORS sectors, and
+   if the disk supports multiple mode, interrupts only once per
+   DRQ block of D->multiple sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t cmd_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+      size_t block_cnt = drq_block_size (d, cmd_cnt);
+      size_t i;
+
+      if (can_dma (d, p, cmd_cnt))
+        {
+          dma_transfer (d, sec_no, cmd_cnt, p, false);
+          p += cmd_cnt * BLOCK_SECTOR_SIZE;
+          sec_no += cmd_cnt;
+          cnt -= cmd_cnt;
+          continue;
+        }
+
+      select_sector (d, sec_no, cmd_cnt);
+      issue_pio_command (c, (block_cnt > 1
+                             ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
+      for (i = 0; i < cmd_cnt; i += block_cnt)
+        {
+          size_t n = cmd_cnt - i < block_cnt ? cmd_cnt - i : block_cnt;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          input_sectors (c, p, n);
+          p += n * BLOCK_SECTOR_SIZE;
+        }
+
+      sec_no += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t cmd_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+      size_t block_cnt = drq_block_size (d, cmd_cnt);
+      size_t i;
+
+      if (can_dma (d, p, cmd_cnt))
+        {
+          dma_transfer (d, sec_no, cmd_cnt, p, true);
+          p += cmd_cnt * BLOCK_SECTOR_SIZE;
+          sec_no += cmd_cnt;
+          cnt -= cmd_cnt;
+          continue;
+        }
+
+      select_sector (d, sec_no, cmd_cnt);
+      issue_pio_command (c, (block_cnt > 1
+                             ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+      for (i = 0; i < cmd_cnt; i += block_cnt)
+        {
+          size_t n = cmd_cnt - i < block_cnt ? cmd_cnt - i : block_cnt;
+
+          /* The disk interrupts when it is ready for each DRQ
+             block after the first. */
+          if (i > 0)
+            sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          output_sectors (c, p, n);
+          p += n * BLOCK_SECTOR_SIZE;
+        }
+      sema_down (&c->completion_wait);
+
+      sec_no += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
+/* Returns true if the CNT sectors at BUFFER can be moved to or
+   from disk D by DMA.  The bus master works on physical
+   addresses, so BUFFER must be in the kernel's direct mapping of
+   physical memory (which also makes it physically contiguous),
+   and it must be word-aligned. */
+static bool
+can_dma (const struct ata_disk *d, const void *buffer, size_t cnt)
+{
+  const uint8_t *end = (const uint8_t *) buffer + cnt * BLOCK_SECTOR_SIZE;
+  return (d->dma
+          && is_kernel_vaddr (buffer)
+          && end > (const uint8_t *) buffer
+          && ((uintptr_t) buffer & 1) == 0);
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes
+   starting at kernel virtual address BUFFER. */
+static void
+setup_prdt (struct channel *c, const void *buffer, size_t size)
+{
+  uintptr_t addr = vtop (buffer);
+  struct prd *prd = c->prdt;
+
+  ASSERT (size > 0);
+  while (size > 0)
+    {
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      ASSERT (prd < c->prdt + PRD_CNT);
+      prd->addr = addr;
+      prd->size = chunk & 0xffff;
+      prd->flags = 0;
+
+      addr += chunk;
+      size -= chunk;
+      prd++;
+    }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and
+   BUFFER by bus master DMA, from the disk to BUFFER if WRITE is
+   false and the other way if it is true.  Sleeps until the
+   transfer completes.  D's channel lock must be held. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status, status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (can_dma (d, buffer, cnt));
+
+  /* Point the bus master at the buffer and clear stale status. */
+  setup_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c),
+        inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+
+  /* Issue the command, start the bus master, and sleep until the
+     disk interrupts to say that the transfer is done. */
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check the outcome. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BM_STA_ERR) || (status & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_CMD_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +707,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Used for DMA commands as well as PIO
+   ones. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -414,20 +720,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -0,0 +1,194 @@
+#include "devices/iobench.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Block device overlap benchmarks.
+
+   "iobench DEV1 DEV2" reads the start of each device
+   sequentially, first one device after the other and then both
+   at once from two threads, and reports the time taken each way.
+   When the two devices are on different IDE channels (e.g. hdb
+   and hdd) their transfers should overlap, so reading both at
+   once should take about as long as the slower device alone
+   rather than as long as the two back to back.  It only reads,
+   so it is safe to point at any device.
+
+   "iobench-swap" does the same with the two kinds of traffic a
+   paging file system kernel mixes: file system reads through the
+   buffer cache, and page-sized writes to the swap device, as
+   swapping out does.  It needs a swap device, e.g. from "pintos
+   --swap-size=4", whose start it overwrites; this kernel does not
+   otherwise use it. */
+
+/* Number of sectors to read from each device. */
+#define IOBENCH_SECTORS 4096
+
+/* Number of sectors per request. */
+#define IOBENCH_CHUNK (4 * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Number of sectors per swap write: one page. */
+#define IOBENCH_SWAP_CHUNK (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* One device's share of the benchmark. */
+struct iobench_job
+  {
+    struct block *block;        /* Device to use. */
+    void (*run) (struct block *);       /* Does the I/O. */
+    struct semaphore done;      /* Up'd when the I/O finishes. */
+  };
+
+/* Reads the first IOBENCH_SECTORS sectors of BLOCK, or all of
+   it if it is smaller. */
+static void
+read_device (struct block *block)
+{
+  void *buffer = palloc_get_multiple (PAL_ASSERT,
+                                      IOBENCH_CHUNK * BLOCK_SECTOR_SIZE
+                                      / PGSIZE);
+  block_sector_t size = block_size (block);
+  block_sector_t sector;
+
+  if (size > IOBENCH_SECTORS)
+    size = IOBENCH_SECTORS;
+  for (sector = 0; sector < size; sector += IOBENCH_CHUNK)
+    {
+      size_t cnt = (size - sector < IOBENCH_CHUNK
+                    ? size - sector : IOBENCH_CHUNK);
+      block_read_multiple (block, sector, cnt, buffer);
+    }
+  palloc_free_multiple (buffer, IOBENCH_CHUNK * BLOCK_SECTOR_SIZE / PGSIZE);
+}
+
+/* Reads the first IOBENCH_SECTORS sectors of the file system
+   device BLOCK one at a time through the buffer cache.  There
+   are many more of them than cache lines, so nearly every read
+   misses and goes to the disk, as reading a large file does. */
+static void
+read_cached (struct block *block)
+{
+  uint8_t buffer[BLOCK_SECTOR_SIZE];
+  block_sector_t size = block_size (block);
+  block_sector_t sector;
+
+  if (size > IOBENCH_SECTORS)
+    size = IOBENCH_SECTORS;
+  for (sector = 0; sector < size; sector++)
+    buffer_cache_read (sector, buffer);
+}
+
+/* Writes the first IOBENCH_SECTORS sectors of swap device BLOCK,
+   or all of it if it is smaller, a page at a time. */
+static void
+write_swap (struct block *block)
+{
+  void *page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  block_sector_t size = block_size (block);
+  block_sector_t sector;
+
+  if (size > IOBENCH_SECTORS)
+    size = IOBENCH_SECTORS;
+  for (sector = 0; sector + IOBENCH_SWAP_CHUNK <= size;
+       sector += IOBENCH_SWAP_CHUNK)
+    block_write_multiple (block, sector, IOBENCH_SWAP_CHUNK, page);
+  palloc_free_page (page);
+}
+
+/* Thread function for running one job concurrently. */
+static void
+iobench_thread (void *job_)
+{
+  struct iobench_job *job = job_;
+  job->run (job->block);
+  sema_up (&job->done);
+}
+
+/* Returns the block device named NAME, panicking if there is
+   none. */
+static struct block *
+get_device (const char *name)
+{
+  struct block *block = block_get_by_name (name);
+  if (block == NULL)
+    PANIC ("iobench: no such block device \"%s\"", name);
+  return block;
+}
+
+/* Times the two JOBS one after the other and then at once, and
+   prints the results. */
+static void
+time_jobs (struct iobench_job jobs[2])
+{
+  int64_t start, alone[2], both;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    sema_init (&jobs[i].done, 0);
+
+  /* Warm up, so that neither measurement benefits from caching
+     in the host that the other did not. */
+  for (i = 0; i < 2; i++)
+    jobs[i].run (jobs[i].block);
+
+  for (i = 0; i < 2; i++)
+    {
+      start = timer_ticks ();
+      jobs[i].run (jobs[i].block);
+      alone[i] = timer_elapsed (start);
+    }
+
+  start = timer_ticks ();
+  for (i = 0; i < 2; i++)
+    if (thread_create ("iobench", PRI_DEFAULT, iobench_thread, &jobs[i])
+        == TID_ERROR)
+      PANIC ("iobench: thread creation failed");
+  for (i = 0; i < 2; i++)
+    sema_down (&jobs[i].done);
+  both = timer_elapsed (start);
+
+  for (i = 0; i < 2; i++)
+    printf ("iobench: %s alone: %"PRId64" ticks\n",
+            block_name (jobs[i].block), alone[i]);
+  printf ("iobench: back to back: %"PRId64" ticks\n", alone[0] + alone[1]);
+  printf ("iobench: concurrently: %"PRId64" ticks\n", both);
+}
+
+/* Runs the benchmark on the devices named by ARGV[1] and
+   ARGV[2]. */
+void
+iobench_run (char **argv)
+{
+  struct iobench_job jobs[2];
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      jobs[i].block = get_device (argv[i + 1]);
+      jobs[i].run = read_device;
+    }
+  time_jobs (jobs);
+}
+
+/* Runs the benchmark on file system reads through the buffer
+   cache and writes to the swap device. */
+void
+iobench_swap_run (char **argv UNUSED)
+{
+  struct iobench_job jobs[2];
+
+  jobs[0].block = fs_device;
+  jobs[0].run = read_cached;
+  jobs[1].block = block_get_role (BLOCK_SWAP);
+  jobs[1].run = write_swap;
+  if (jobs[1].block == NULL)
+    PANIC ("iobench: no swap device");
+  time_jobs (jobs);
+}
@@ -0,0 +1,7 @@
+#ifndef DEVICES_IOBENCH_H
+#define DEVICES_IOBENCH_H
+
+void iobench_run (char **argv);
+void iobench_swap_run (char **argv);
+
+#endif /* devices/iobench.h */
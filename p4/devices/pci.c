@@ -0,0 +1,138 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, the pair of I/O ports that every PC chipset
+   since the original PCI ones provides.  See [PCI] 3.2.2.3.2.
+
+   Only what the disk drivers need is here: finding a device by
+   class or by a caller-supplied predicate, reading its I/O base
+   address registers, and turning on I/O decoding and bus
+   mastering. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* PCI bus geometry. */
+#define PCI_BUS_CNT 256
+#define PCI_SLOT_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Reads the 32-bit configuration register at offset REG of the
+   given function. */
+static uint32_t
+read_config (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (bus << 16) | (slot << 11)
+                             | (func << 8) | (reg & 0xfc)));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Reads configuration register REG of device D. */
+uint32_t
+pci_read_config (const struct pci_dev *d, uint8_t reg)
+{
+  return read_config (d->bus, d->slot, d->func, reg);
+}
+
+/* Writes VALUE to configuration register REG of device D. */
+void
+pci_write_config (const struct pci_dev *d, uint8_t reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (d->bus << 16) | (d->slot << 11)
+                             | (d->func << 8) | (reg & 0xfc)));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns the I/O port base in base address register BAR of D,
+   or 0 if BAR is unimplemented or maps memory space. */
+uint16_t
+pci_io_bar (const struct pci_dev *d, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (d, PCI_REG_BAR0 + bar * 4);
+  return (value & 1) ? value & 0xfffc : 0;
+}
+
+/* Sets COMMAND_BITS (a combination of PCI_CMD_* bits) in D's
+   command register. */
+void
+pci_enable (const struct pci_dev *d, uint16_t command_bits)
+{
+  uint32_t command = pci_read_config (d, PCI_REG_COMMAND);
+  pci_write_config (d, PCI_REG_COMMAND, (command & 0xffff) | command_bits);
+}
+
+/* Scans the PCI buses in order and stores into *D the INDEXth
+   (counting from 0) function for which MATCH returns true.
+   Returns true if successful, false if there is no such
+   function. */
+bool
+pci_find (pci_match_func *match, void *aux, int index, struct pci_dev *d)
+{
+  int bus, slot, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (slot = 0; slot < PCI_SLOT_CNT; slot++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id = read_config (bus, slot, func, 0x00);
+          uint32_t class;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing, so
+                 is the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class = read_config (bus, slot, func, 0x08);
+          d->bus = bus;
+          d->slot = slot;
+          d->func = func;
+          d->vendor_id = id & 0xffff;
+          d->device_id = id >> 16;
+          d->class = class >> 24;
+          d->subclass = class >> 16;
+          d->prog_if = class >> 8;
+          d->irq = read_config (bus, slot, func, PCI_REG_INTR) & 0xff;
+          if (match (d, aux) && index-- == 0)
+            return true;
+
+          /* Single-function devices may alias function 0 in the
+             other function numbers. */
+          if (func == 0
+              && !(read_config (bus, slot, 0, 0x0c) & 0x00800000))
+            break;
+        }
+
+  return false;
+}
+
+/* pci_find() predicate that matches the class and subclass in
+   the two-element array CLASS_. */
+static bool
+match_class (const struct pci_dev *d, void *class_)
+{
+  const uint8_t *class = class_;
+  return d->class == class[0] && d->subclass == class[1];
+}
+
+/* Stores into *D the first PCI function with the given CLASS
+   and SUBCLASS codes.  Returns true if successful, false if
+   there is none. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *d)
+{
+  uint8_t codes[2];
+
+  codes[0] = class;
+  codes[1] = subclass;
+  return pci_find (match_class, codes, 0, d);
+}
@@ -0,0 +1,41 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function of a device on the PCI bus. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t slot;               /* Device number on BUS. */
+    uint8_t func;               /* Function number within device. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Base class code. */
+    uint8_t subclass;           /* Sub-class code. */
+    uint8_t prog_if;            /* Programming interface. */
+    uint8_t irq;                /* Legacy interrupt line (0...15). */
+  };
+
+/* Configuration space register offsets. */
+#define PCI_REG_COMMAND 0x04    /* Command (low 16 bits). */
+#define PCI_REG_BAR0 0x10       /* Base address register 0. */
+#define PCI_REG_INTR 0x3c       /* Interrupt line (low 8 bits). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MEM 0x0002      /* Respond to memory space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* May act as a bus master. */
+
+typedef bool pci_match_func (const struct pci_dev *, void *aux);
+
+bool pci_find (pci_match_func *, void *aux, int index, struct pci_dev *);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+uint16_t pci_io_bar (const struct pci_dev *, int bar);
+void pci_enable (const struct pci_dev *, uint16_t command_bits);
+
+#endif /* devices/pci.h */
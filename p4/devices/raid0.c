@@ -0,0 +1,229 @@
+#include "devices/raid0.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/* A RAID-0 ("striped") block device built from other block
+   devices.
+
+   The device's sectors are divided into chunks of CHUNK
+   sectors, and chunk number C lives on member C % N, at chunk
+   C / N within that member, where N is the number of members.
+   A long sequential transfer therefore touches every member,
+   and since each member has its own request queue (and IDE
+   disks on different channels transfer concurrently) the
+   members work on their pieces at the same time.
+
+   There is no redundancy: losing any member loses the array.
+   The array keeps no metadata on disk, so it must be assembled
+   from the same members in the same order on every boot. */
+
+/* Chunk size used if none is given, in sectors. */
+#define DEFAULT_CHUNK 8
+
+/* Maximum number of member devices. */
+#define MAX_MEMBERS 8
+
+/* A striped device. */
+struct raid0
+  {
+    struct block *members[MAX_MEMBERS]; /* Member devices, in order. */
+    size_t member_cnt;                  /* Number of members. */
+    block_sector_t chunk;               /* Sectors per chunk. */
+  };
+
+/* A request that spans more than one chunk, split into one
+   request per chunk. */
+struct split
+  {
+    struct block_request *parent;       /* Original request. */
+    size_t pending;                     /* Pieces not yet completed. */
+    struct block_request pieces[];      /* One per chunk. */
+  };
+
+/* We support a single array. */
+static struct raid0 raid0;
+
+static struct block_operations raid0_operations;
+
+/* Assembles a striped device from the devices named in MEMBERS,
+   a comma-separated list such as "hdb,hdc", with CHUNK_SECTORS
+   sectors per chunk (or a default if it is 0), and registers it
+   as device "md0".  The members should be raw disks that play
+   no other role.  Select the array for a role with, e.g.,
+   "-filesys=md0". */
+void
+raid0_init (char *members, size_t chunk_sectors)
+{
+  struct raid0 *r = &raid0;
+  block_sector_t member_size = 0;
+  char *name, *save_ptr;
+  size_t i;
+
+  ASSERT (r->member_cnt == 0);
+
+  r->chunk = chunk_sectors != 0 ? chunk_sectors : DEFAULT_CHUNK;
+  for (name = strtok_r (members, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (name);
+      if (block == NULL)
+        PANIC ("md0: no such block device \"%s\"", name);
+      if (r->member_cnt >= MAX_MEMBERS)
+        PANIC ("md0: too many members (max %d)", MAX_MEMBERS);
+      for (i = 0; i < r->member_cnt; i++)
+        if (r->members[i] == block)
+          PANIC ("md0: %s named twice", name);
+
+      if (r->member_cnt == 0 || block_size (block) < member_size)
+        member_size = block_size (block);
+      r->members[r->member_cnt++] = block;
+    }
+  if (r->member_cnt < 2)
+    PANIC ("md0: at least two members are needed");
+
+  /* Members larger than the smallest have unused space at the
+     end, as does every member past its last whole chunk. */
+  member_size -= member_size % r->chunk;
+  if (member_size == 0)
+    PANIC ("md0: members are smaller than one chunk");
+  if (member_size > UINT32_MAX / r->member_cnt)
+    PANIC ("md0: %zu members of %"PRDSNu" sectors are too large "
+           "for a block_sector_t", r->member_cnt, member_size);
+
+  block_register ("md0", BLOCK_RAW, "RAID-0", member_size * r->member_cnt,
+                  &raid0_operations, r);
+}
+
+/* Maps SECTOR on array R to a member, returned, and a sector
+   within that member, stored into *MEMBER_SECTOR.  Also stores
+   into *LEFT the number of sectors from SECTOR to the end of its
+   chunk. */
+static struct block *
+map_sector (const struct raid0 *r, block_sector_t sector,
+            block_sector_t *member_sector, size_t *left)
+{
+  block_sector_t chunk = sector / r->chunk;
+  block_sector_t ofs = sector % r->chunk;
+
+  *member_sector = chunk / r->member_cnt * r->chunk + ofs;
+  *left = r->chunk - ofs;
+  return r->members[chunk % r->member_cnt];
+}
+
+/* Completion callback for a piece of a split request.  The last
+   piece to finish completes the original request. */
+static void
+piece_complete (struct block_request *piece)
+{
+  struct split *s = piece->aux;
+  enum intr_level old_level;
+  size_t pending;
+
+  old_level = intr_disable ();
+  pending = --s->pending;
+  intr_set_level (old_level);
+
+  if (pending == 0)
+    {
+      block_complete (s->parent);
+      free (s);
+    }
+}
+
+/* Carries out REQ on array R a chunk at a time, waiting for each
+   piece.  Used only if there is no memory to split REQ. */
+static void
+transfer_serially (struct raid0 *r, struct block_request *req)
+{
+  block_sector_t sector = req->sector;
+  uint8_t *buffer = req->buffer;
+  size_t cnt = req->cnt;
+
+  while (cnt > 0)
+    {
+      struct block_request piece;
+      block_sector_t member_sector;
+      struct block *member;
+      size_t piece_cnt;
+
+      member = map_sector (r, sector, &member_sector, &piece_cnt);
+      if (piece_cnt > cnt)
+        piece_cnt = cnt;
+      block_request_init (&piece, req->write, member_sector, piece_cnt,
+                          buffer, NULL, NULL);
+      block_submit (member, &piece);
+      block_wait (&piece);
+
+      sector += piece_cnt;
+      buffer += piece_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= piece_cnt;
+    }
+  block_complete (req);
+}
+
+/* Passes REQ on to the members of array R_.  A request within a
+   single chunk goes to its member as is; a longer one is split
+   at chunk boundaries and its pieces submitted together, so that
+   the members work on them in parallel. */
+static void
+raid0_submit (void *r_, struct block_request *req)
+{
+  struct raid0 *r = r_;
+  bool req_write = req->write;
+  block_sector_t sector, member_sector;
+  size_t piece_cnt, cnt, left, i;
+  struct block *member;
+  uint8_t *buffer;
+  struct split *s;
+
+  member = map_sector (r, req->sector, &member_sector, &piece_cnt);
+  if (req->cnt <= piece_cnt)
+    {
+      req->sector = member_sector;
+      block_submit (member, req);
+      return;
+    }
+
+  /* The first piece is PIECE_CNT sectors, the rest are whole
+     chunks except perhaps the last. */
+  cnt = 1 + DIV_ROUND_UP (req->cnt - piece_cnt, r->chunk);
+  s = malloc (sizeof *s + cnt * sizeof *s->pieces);
+  if (s == NULL)
+    {
+      transfer_serially (r, req);
+      return;
+    }
+  s->parent = req;
+  s->pending = cnt;
+
+  /* S may be freed, and REQ completed, as soon as the last piece
+     is submitted, so work from copies of their fields. */
+  sector = req->sector;
+  left = req->cnt;
+  buffer = req->buffer;
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *piece = &s->pieces[i];
+
+      member = map_sector (r, sector, &member_sector, &piece_cnt);
+      if (piece_cnt > left)
+        piece_cnt = left;
+      block_request_init (piece, req_write, member_sector, piece_cnt,
+                          buffer, piece_complete, s);
+      sector += piece_cnt;
+      buffer += piece_cnt * BLOCK_SECTOR_SIZE;
+      left -= piece_cnt;
+      block_submit (member, piece);
+    }
+}
+
+static struct block_operations raid0_operations =
+  {
+    .submit = raid0_submit
+  };
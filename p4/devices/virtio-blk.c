@@ -0,0 +1,483 @@
+#include "devices/virtio-blk.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Driver for the paravirtual block device that QEMU and KVM
+   provide as "-drive if=virtio", using the legacy (virtio 0.9.5)
+   PCI interface.  See [VIRTIO] 2.1 and 5.2.
+
+   Unlike IDE, the device has no registers to program per
+   transfer.  Each request is a chain of descriptors in a ring
+   shared with the host: a header naming the operation and
+   sector, one descriptor per physically contiguous segment of
+   the data buffer, and a status byte the host fills in.
+   The driver places the chain's head in the "available" ring and
+   writes the queue number to the notify register; the host later
+   puts it in the "used" ring and raises an interrupt.  Any number
+   of requests up to the ring size may be outstanding at once, so
+   the driver supplies the block layer's submit operation and does
+   no queuing of its own.
+
+   Completions are noticed in the interrupt handler but processed
+   by a kernel thread per device, because block_complete() may
+   wake waiters and callbacks that need to acquire locks. */
+
+/* Legacy virtio PCI register offsets from I/O BAR 0. */
+#define VIRTIO_REG_DEVICE_FEATURES 0x00 /* Features host offers. */
+#define VIRTIO_REG_GUEST_FEATURES 0x04  /* Features guest accepts. */
+#define VIRTIO_REG_QUEUE_PFN 0x08       /* Ring physical page number. */
+#define VIRTIO_REG_QUEUE_SIZE 0x0c      /* Entries in selected queue. */
+#define VIRTIO_REG_QUEUE_SELECT 0x0e    /* Queue to configure. */
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10    /* Write queue number to kick. */
+#define VIRTIO_REG_STATUS 0x12          /* Device status. */
+#define VIRTIO_REG_ISR 0x13             /* Interrupt status, read clears. */
+#define VIRTIO_BLK_REG_CAPACITY 0x14    /* 64-bit size in sectors. */
+
+/* Device status bits. */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01  /* Guest has seen the device. */
+#define VIRTIO_STATUS_DRIVER 0x02       /* Guest has a driver for it. */
+#define VIRTIO_STATUS_DRIVER_OK 0x04    /* Driver is ready. */
+#define VIRTIO_STATUS_FAILED 0x80       /* Driver gave up. */
+
+/* Descriptor flags. */
+#define VRING_DESC_F_NEXT 0x01          /* NEXT field is valid. */
+#define VRING_DESC_F_WRITE 0x02         /* Host writes this buffer. */
+
+/* Request types and status. */
+#define VIRTIO_BLK_T_IN 0               /* Read. */
+#define VIRTIO_BLK_T_OUT 1              /* Write. */
+#define VIRTIO_BLK_S_OK 0               /* Success. */
+
+/* PCI identification of a legacy virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy rings are laid out with the used ring on a page
+   boundary of this size. */
+#define VRING_ALIGN 4096
+
+/* Data segments per request.  A segment ends at a page boundary
+   unless the next page is physically adjacent.  Kernel buffers
+   are physically contiguous and always make a single segment, so
+   a few are enough; more descriptors per request would leave
+   fewer request slots in the ring. */
+#define REQ_SEG_CNT 4
+
+/* Descriptors per request: header, data segments, status. */
+#define REQ_DESC_CNT (REQ_SEG_CNT + 2)
+
+/* Maximum number of virtio block devices we support. */
+#define MAX_DEVICES 4
+
+/* A descriptor in the ring's descriptor table. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor in chain. */
+  };
+
+/* The ring of descriptor chains offered to the host. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Next ring entry we will fill. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of completed chain. */
+    uint32_t len;               /* Bytes the host wrote. */
+  };
+
+/* The ring of descriptor chains the host has finished with. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Next ring entry host will fill. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header at the start of each request. */
+struct virtio_blk_req_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector to transfer. */
+  };
+
+/* A request slot.  Slot N owns descriptors N * REQ_DESC_CNT
+   through N * REQ_DESC_CNT + REQ_DESC_CNT - 1, so no descriptor
+   free list is needed. */
+struct slot
+  {
+    struct virtio_blk_req_hdr hdr;      /* Read by host. */
+    uint8_t status;                     /* Written by host. */
+    struct block_request *req;          /* Request in progress. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t reg_base;          /* Base I/O port of registers. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    uint16_t queue_size;        /* Entries in the rings. */
+    size_t ring_pages;          /* Pages holding the rings. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t last_used;         /* Used ring entries processed. */
+
+    struct slot *slots;         /* Request slots. */
+    struct bitmap *busy_slots;  /* Slots in use. */
+
+    struct lock lock;           /* Protects all of the above. */
+    struct condition slot_free; /* Signaled when a slot frees up. */
+    struct semaphore intr_sema; /* Upped by interrupt handler. */
+  };
+
+static struct virtio_blk devices[MAX_DEVICES];
+static size_t device_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool match_virtio_blk (const struct pci_dev *, void *);
+static bool irq_available (uint8_t irq);
+static bool init_device (struct virtio_blk *, const struct pci_dev *,
+                         block_sector_t *);
+static void completion_thread (void *d_);
+static intr_handler_func interrupt_handler;
+
+/* Finds and registers every virtio block device on the PCI
+   bus, naming them "vda", "vdb", and so on, and scans each for
+   partitions. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  int index;
+
+  for (index = 0; device_cnt < MAX_DEVICES
+         && pci_find (match_virtio_blk, NULL, index, &pci); index++)
+    {
+      struct virtio_blk *d = &devices[device_cnt];
+      char thread_name[16];
+      block_sector_t size;
+      struct block *block;
+      size_t i;
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + device_cnt);
+      if (pci.irq < 16 && !irq_available (pci.irq + 0x20))
+        {
+          printf ("%s: interrupt line %"PRIu8" in use by %s, ignoring\n",
+                  d->name, pci.irq, intr_name (pci.irq + 0x20));
+          continue;
+        }
+      if (!init_device (d, &pci, &size))
+        continue;
+
+      snprintf (thread_name, sizeof thread_name, "%s-done", d->name);
+      if (thread_create (thread_name, PRI_MAX, completion_thread, d)
+          == TID_ERROR)
+        {
+          printf ("%s: failed to start completion thread, ignoring\n",
+                  d->name);
+          /* Reset the device so that it lets go of the queue. */
+          outb (d->reg_base + VIRTIO_REG_STATUS, 0);
+          outb (d->reg_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+          palloc_free_multiple (d->desc, d->ring_pages);
+          free (d->slots);
+          bitmap_destroy (d->busy_slots);
+          continue;
+        }
+      device_cnt++;
+
+      /* Several devices may share one interrupt line. */
+      for (i = 0; i + 1 < device_cnt; i++)
+        if (devices[i].irq == d->irq)
+          break;
+      if (i + 1 == device_cnt)
+        intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+
+      block = block_register (d->name, BLOCK_RAW, "virtio disk", size,
+                              &virtio_blk_operations, d);
+      partition_scan (block);
+    }
+}
+
+/* pci_find() predicate for legacy virtio block devices. */
+static bool
+match_virtio_blk (const struct pci_dev *pci, void *aux UNUSED)
+{
+  return (pci->vendor_id == VIRTIO_VENDOR_ID
+          && pci->device_id == VIRTIO_BLK_DEVICE_ID);
+}
+
+/* Returns true if interrupt IRQ is free, or already handled by
+   this driver for another device.  intr_register_ext() allows
+   only one handler per interrupt, so a line that another driver
+   already uses cannot be shared. */
+static bool
+irq_available (uint8_t irq)
+{
+  size_t i;
+
+  for (i = 0; i < device_cnt; i++)
+    if (devices[i].irq == irq)
+      return true;
+  return !intr_is_registered (irq);
+}
+
+/* Resets the device described by PCI, sets up its request
+   queue, and tells it the driver is ready.  Stores the disk's
+   size in sectors into *SIZE.  Returns true if successful,
+   false if the device cannot be used (after printing why). */
+static bool
+init_device (struct virtio_blk *d, const struct pci_dev *pci,
+             block_sector_t *size)
+{
+  size_t avail_size, used_ofs, ring_size;
+  uint32_t capacity_lo, capacity_hi;
+  size_t slot_cnt;
+  uint8_t *ring;
+
+  d->reg_base = pci_io_bar (pci, 0);
+  if (d->reg_base == 0 || pci->irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt assigned, ignoring\n",
+              d->name);
+      return false;
+    }
+  d->irq = pci->irq + 0x20;
+  pci_enable (pci, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset, then announce ourselves.  We need none of the
+     optional features. */
+  outb (d->reg_base + VIRTIO_REG_STATUS, 0);
+  outb (d->reg_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  outb (d->reg_base + VIRTIO_REG_STATUS,
+        VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+  outl (d->reg_base + VIRTIO_REG_GUEST_FEATURES, 0);
+
+  capacity_lo = inl (d->reg_base + VIRTIO_BLK_REG_CAPACITY);
+  capacity_hi = inl (d->reg_base + VIRTIO_BLK_REG_CAPACITY + 4);
+  if (capacity_hi != 0)
+    {
+      printf ("%s: too large for a block_sector_t, ignoring\n", d->name);
+      goto fail;
+    }
+  *size = capacity_lo;
+
+  /* The ring size is fixed by the host.  Lay out the descriptor
+     table and available ring, then the used ring on the next
+     VRING_ALIGN boundary, in physically contiguous memory. */
+  outw (d->reg_base + VIRTIO_REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->reg_base + VIRTIO_REG_QUEUE_SIZE);
+  if (d->queue_size < REQ_DESC_CNT)
+    {
+      printf ("%s: request queue too small, ignoring\n", d->name);
+      goto fail;
+    }
+  avail_size = sizeof *d->avail + d->queue_size * sizeof *d->avail->ring;
+  used_ofs = ROUND_UP (d->queue_size * sizeof *d->desc + avail_size,
+                       VRING_ALIGN);
+  ring_size = used_ofs + ROUND_UP (sizeof *d->used + (d->queue_size
+                                   * sizeof *d->used->ring), VRING_ALIGN);
+  d->ring_pages = DIV_ROUND_UP (ring_size, PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, d->ring_pages);
+  slot_cnt = d->queue_size / REQ_DESC_CNT;
+  d->slots = malloc (slot_cnt * sizeof *d->slots);
+  d->busy_slots = bitmap_create (slot_cnt);
+  if (ring == NULL || d->slots == NULL || d->busy_slots == NULL)
+    PANIC ("%s: out of memory for request queue", d->name);
+
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + (d->queue_size
+                                             * sizeof *d->desc));
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->last_used = 0;
+  lock_init (&d->lock);
+  cond_init (&d->slot_free);
+  sema_init (&d->intr_sema, 0);
+
+  outl (d->reg_base + VIRTIO_REG_QUEUE_PFN, vtop (ring) / VRING_ALIGN);
+  outb (d->reg_base + VIRTIO_REG_STATUS,
+        (VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER
+         | VIRTIO_STATUS_DRIVER_OK));
+  return true;
+
+ fail:
+  outb (d->reg_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+  return false;
+}
+
+/* Fills in descriptor IDX of D. */
+static void
+set_desc (struct virtio_blk *d, size_t idx, const void *buffer,
+          size_t len, uint16_t flags)
+{
+  struct vring_desc *desc = &d->desc[idx];
+
+  desc->addr = vtop (buffer);
+  desc->len = len;
+  desc->flags = flags;
+  desc->next = (flags & VRING_DESC_F_NEXT) ? idx + 1 : 0;
+}
+
+/* Describes the SIZE bytes at BUFFER with descriptors of D from
+   IDX on, one per physically contiguous segment, with FLAGS.
+   Returns the index of the first descriptor not used. */
+static size_t
+set_data_desc (struct virtio_blk *d, size_t idx, uint8_t *buffer,
+               size_t size, uint16_t flags)
+{
+  size_t first = idx;
+
+  while (size > 0)
+    {
+      size_t len = PGSIZE - pg_ofs (buffer);
+      struct vring_desc *prev = &d->desc[idx - 1];
+
+      if (len > size)
+        len = size;
+      if (idx > first && prev->addr + prev->len == vtop (buffer))
+        prev->len += len;
+      else
+        {
+          ASSERT (idx - first < REQ_SEG_CNT);
+          set_desc (d, idx++, buffer, len, flags);
+        }
+      buffer += len;
+      size -= len;
+    }
+  return idx;
+}
+
+/* Hands REQ to the host, waiting for a free request slot if
+   all are busy.  The buffer must be in kernel memory.  It is
+   passed to the host as a scatter-gather list of its physical
+   segments. */
+static void
+virtio_blk_submit (void *d_, struct block_request *req)
+{
+  struct virtio_blk *d = d_;
+  struct slot *slot;
+  size_t slot_no, head, idx;
+
+  ASSERT (is_kernel_vaddr (req->buffer));
+
+  lock_acquire (&d->lock);
+  while ((slot_no = bitmap_scan_and_flip (d->busy_slots, 0, 1, false))
+         == BITMAP_ERROR)
+    cond_wait (&d->slot_free, &d->lock);
+
+  slot = &d->slots[slot_no];
+  slot->hdr.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  slot->hdr.reserved = 0;
+  slot->hdr.sector = req->sector;
+  slot->status = 0xff;
+  slot->req = req;
+
+  head = slot_no * REQ_DESC_CNT;
+  set_desc (d, head, &slot->hdr, sizeof slot->hdr, VRING_DESC_F_NEXT);
+  idx = set_data_desc (d, head + 1, req->buffer,
+                       req->cnt * BLOCK_SECTOR_SIZE,
+                       (VRING_DESC_F_NEXT
+                        | (req->write ? 0 : VRING_DESC_F_WRITE)));
+  set_desc (d, idx, &slot->status, sizeof slot->status,
+            VRING_DESC_F_WRITE);
+
+  /* The host may look at the ring as soon as the index moves,
+     so the entry must be in memory first. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->reg_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+  lock_release (&d->lock);
+}
+
+/* Completes the requests that device D_ has returned in its
+   used ring, each time the interrupt handler reports that there
+   may be some. */
+static void
+completion_thread (void *d_)
+{
+  struct virtio_blk *d = d_;
+
+  for (;;)
+    {
+      sema_down (&d->intr_sema);
+      for (;;)
+        {
+          struct block_request *req;
+          struct slot *slot;
+          size_t slot_no;
+          uint8_t status;
+
+          lock_acquire (&d->lock);
+          if (d->last_used == d->used->idx)
+            {
+              lock_release (&d->lock);
+              break;
+            }
+          barrier ();
+          slot_no = (d->used->ring[d->last_used % d->queue_size].id
+                     / REQ_DESC_CNT);
+          d->last_used++;
+          slot = &d->slots[slot_no];
+          req = slot->req;
+          status = slot->status;
+          bitmap_reset (d->busy_slots, slot_no);
+          cond_signal (&d->slot_free, &d->lock);
+          lock_release (&d->lock);
+
+          if (status != VIRTIO_BLK_S_OK)
+            PANIC ("%s: %s failed, sector=%"PRDSNu", status=%"PRIu8,
+                   d->name, req->write ? "write" : "read", req->sector,
+                   status);
+          block_complete (req);
+        }
+    }
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    .submit = virtio_blk_submit
+  };
+
+/* Virtio interrupt handler.  Reading the ISR register
+   acknowledges the interrupt; bit 0 says the used ring has new
+   entries. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < device_cnt; i++)
+    {
+      struct virtio_blk *d = &devices[i];
+      if (d->irq == f->vec_no
+          && (inb (d->reg_base + VIRTIO_REG_ISR) & 0x01))
+        sema_up (&d->intr_sema);
+    }
+}
@@ -10,50 +10,111 @@
 /* Buffer Caches. */
 static struct cache caches[CACHE_CNT];
 
-/* A lock for synchronizing cache operations. */
+/* A lock for synchronizing cache operations.  It is not held
+   while a cacheline is being read or written back, so that a
+   thread waiting on the disk does not stall cache hits, or
+   transfers on other devices, behind it. */
 static struct lock buffer_cache_lock;
 
+/* Signaled whenever a cacheline stops being busy, or a flush
+   of all lines finishes. */
+static struct condition buffer_cache_io_done;
+
+/* Whether buffer_cache_flush_all() is in progress.  Its request
+   array is too large for a kernel stack, so there is one, and
+   only one flush may use it at a time. */
+static bool flushing;
+
 static void periodic_write (void* aux UNUSED);
 
 void
 buffer_cache_init (void)
 {
   lock_init (&buffer_cache_lock);
+  cond_init (&buffer_cache_io_done);
   for (size_t i = 0; i < CACHE_CNT; ++i)
+  {
     caches[i].free = true;
+    caches[i].busy = false;
+  }
+  flushing = false;
     
   // thread_create ("periodic_write_thread", PRI_DEFAULT, periodic_write, NULL);
 }
 
+/* Marks ENTRY busy and drops the cache lock, so that the caller
+   can move its data to or from disk. */
 static void
-buffer_cache_flush (struct cache *entry)
+buffer_cache_begin_io (struct cache *entry)
 {
   ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
-  ASSERT (entry != NULL);
-
-  if (entry->free)
-    return;
+  ASSERT (!entry->busy);
 
-  if (entry->dirty) {
-    block_write (fs_device, entry->disk_sector, entry->buffer);
-    entry->dirty = false;
-  }
+  entry->busy = true;
+  lock_release (&buffer_cache_lock);
 }
 
-void
-buffer_cache_close (void)
+/* Reacquires the cache lock after a transfer on ENTRY and wakes
+   up anyone waiting for it. */
+static void
+buffer_cache_end_io (struct cache *entry)
 {
   lock_acquire (&buffer_cache_lock);
+  entry->busy = false;
+  cond_broadcast (&buffer_cache_io_done, &buffer_cache_lock);
+}
 
+/* Writes back every dirty cache entry.  All of the writes are
+   submitted before waiting for any of them, so the block layer
+   can sort them into a single sweep across the disk.  A caller
+   that finds another flush in progress waits for it to finish
+   first. */
+static void
+buffer_cache_flush_all (void)
+{
+  static struct block_request requests[CACHE_CNT];
+  static bool submitted[CACHE_CNT];
   size_t i;
+
+  ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
+
+  while (flushing)
+    cond_wait (&buffer_cache_io_done, &buffer_cache_lock);
+  flushing = true;
+
   for (i = 0; i < CACHE_CNT; ++i)
   {
-    if (caches[i].free == true)
+    submitted[i] = !caches[i].free && !caches[i].busy && caches[i].dirty;
+    if (!submitted[i])
       continue;
-    
-    buffer_cache_flush(&(caches[i]));
+
+    caches[i].busy = true;
+    block_request_init (&requests[i], true, caches[i].disk_sector, 1,
+                        caches[i].buffer, NULL, NULL);
+    block_submit (fs_device, &requests[i]);
   }
+  lock_release (&buffer_cache_lock);
 
+  for (i = 0; i < CACHE_CNT; ++i)
+    if (submitted[i])
+      block_wait (&requests[i]);
+
+  lock_acquire (&buffer_cache_lock);
+  for (i = 0; i < CACHE_CNT; ++i)
+    if (submitted[i])
+    {
+      caches[i].dirty = false;
+      caches[i].busy = false;
+    }
+  flushing = false;
+  cond_broadcast (&buffer_cache_io_done, &buffer_cache_lock);
+}
+
+void
+buffer_cache_close (void)
+{
+  lock_acquire (&buffer_cache_lock);
+  buffer_cache_flush_all ();
   lock_release (&buffer_cache_lock);
 }
 
@@ -73,6 +134,11 @@ buffer_cache_lookup (block_sector_t sector)
   return NULL;
 }
 
+/* Returns a free cacheline, or a null pointer if the caller has
+   to look again because none was free: either every line is
+   busy, in which case this waits for one to finish, or the LRU
+   line was dirty and this wrote it back, dropping the cache lock
+   while doing so. */
 static struct cache*
 buffer_cache_evict (void)
 {
@@ -80,45 +146,86 @@ buffer_cache_evict (void)
   /* Firstly, check if there's free cache space already */
   for (size_t i = 0; i < CACHE_CNT; ++i)
   {
-    if (caches[i].free)
+    if (caches[i].free && !caches[i].busy)
       return &(caches[i]);
   }
 
   /* Secondly, find the LRU cache to evict */
   int64_t LRU_time = INT64_MAX;
-  size_t LRU_idx = 0;
+  struct cache *evi_cache = NULL;
   for (size_t i = 0; i < CACHE_CNT; ++i)
   {
-    if (caches[i].time_stamp < LRU_time)
+    if (!caches[i].busy && caches[i].time_stamp < LRU_time)
     {
-      LRU_idx = i;
+      evi_cache = &caches[i];
       LRU_time = caches[i].time_stamp;
     }
   }
-  struct cache *evi_cache = &caches[LRU_idx];
+  if (evi_cache == NULL)
+  {
+    cond_wait (&buffer_cache_io_done, &buffer_cache_lock);
+    return NULL;
+  }
+
   if (evi_cache->dirty)
-    buffer_cache_flush (evi_cache);
+  {
+    buffer_cache_begin_io (evi_cache);
+    block_write (fs_device, evi_cache->disk_sector, evi_cache->buffer);
+    buffer_cache_end_io (evi_cache);
+    evi_cache->dirty = false;
+    evi_cache->free = true;
+    return NULL;
+  }
+
   evi_cache->free = true;
-  evi_cache->dirty = false;
   return evi_cache;
 }
 
-void
-buffer_cache_read (block_sector_t sector, void *target)
+/* Returns the idle cacheline holding SECTOR, allocating one if
+   necessary.  If the sector was not cached and READ is true, its
+   contents are read from disk; otherwise the caller is about to
+   overwrite the whole line.  Waits for any transfer already in
+   progress on the sector. */
+static struct cache*
+buffer_cache_get (block_sector_t sector, bool read)
 {
-  lock_acquire (&buffer_cache_lock);
+  ASSERT (lock_held_by_current_thread(&buffer_cache_lock));
+
+  for (;;)
+  {
+    struct cache *slot = buffer_cache_lookup (sector);
+    if (slot != NULL)
+    {
+      if (!slot->busy)
+        return slot;
+      cond_wait (&buffer_cache_io_done, &buffer_cache_lock);
+      continue;
+    }
 
-  struct cache *slot = buffer_cache_lookup (sector);
-  if (slot == NULL) {
     slot = buffer_cache_evict ();
-    ASSERT (slot != NULL && slot->free == true);
+    if (slot == NULL)
+      continue;
+    ASSERT (slot->free == true && !slot->busy);
 
     slot->free = false;
     slot->disk_sector = sector;
     slot->dirty = false;
-    block_read (fs_device, sector, slot->buffer);
+    if (read)
+    {
+      buffer_cache_begin_io (slot);
+      block_read (fs_device, sector, slot->buffer);
+      buffer_cache_end_io (slot);
+    }
+    return slot;
   }
+}
 
+void
+buffer_cache_read (block_sector_t sector, void *target)
+{
+  lock_acquire (&buffer_cache_lock);
+
+  struct cache *slot = buffer_cache_get (sector, true);
   slot->time_stamp = timer_ticks();
   memcpy (target, slot->buffer, BLOCK_SECTOR_SIZE);
 
@@ -130,17 +237,9 @@ buffer_cache_write (block_sector_t sector, const void *source)
 {
   lock_acquire (&buffer_cache_lock);
 
-  struct cache *slot = buffer_cache_lookup (sector);
-  if (slot == NULL) {
-    slot = buffer_cache_evict ();
-    ASSERT (slot != NULL && slot->free == true);
-
-    slot->free = false;
-    slot->disk_sector = sector;
-    slot->dirty = false;
-    block_read (fs_device, sector, slot->buffer);
-  }
-
+  /* The whole sector is overwritten, so there is no need to read
+     it in first. */
+  struct cache *slot = buffer_cache_get (sector, false);
   slot->dirty = true;
   slot->time_stamp = timer_ticks();
   memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
@@ -151,13 +250,7 @@ buffer_cache_write (block_sector_t sector, const void *source)
 void cache_to_disk ()
 {
     lock_acquire (&buffer_cache_lock);
-
-    for (size_t i = 0; i < CACHE_CNT; i++)
-    {
-      if (caches[i].dirty)
-	      block_write (fs_device, caches[i].disk_sector, caches[i].buffer);
-    }
-
+    buffer_cache_flush_all ();
     lock_release (&buffer_cache_lock);
 }
 
@@ -10,6 +10,9 @@ struct cache
   bool free;
   /* Dirty bit */
   bool dirty;
+  /* Whether a disk transfer on this cacheline is in progress.
+     Nobody else may use or evict the line until it finishes. */
+  bool busy;
   /* The time_ticks last used, for LRU evict. */
   int64_t time_stamp;
 
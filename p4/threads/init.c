@@ -34,6 +34,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/iobench.h"
+#include "devices/raid0.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -49,9 +53,16 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
-#ifdef VM
 static const char *swap_bdev_name;
-#endif
+
+/* -ramdisk=ROLE:KB: Role and size of the RAM disk, if any. */
+static enum block_type ramdisk_role;
+static size_t ramdisk_size_kb;
+
+/* -raid0=BDEV,BDEV...[:SECTORS]: Members and chunk size of the
+   striped device, if any. */
+static char *raid0_members;
+static size_t raid0_chunk;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -66,6 +77,8 @@ static void run_actions (char **argv);
 static void usage (void);
 
 #ifdef FILESYS
+static void configure_ramdisk (char *value);
+static void configure_raid0 (char *value);
 static void locate_block_devices (void);
 static void locate_block_device (enum block_type, const char *name);
 #endif
@@ -122,7 +135,12 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
+  if (ramdisk_size_kb > 0)
+    ramdisk_init (ramdisk_role, ramdisk_size_kb);
   ide_init ();
+  virtio_blk_init ();
+  if (raid0_members != NULL)
+    raid0_init (raid0_members, raid0_chunk);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -247,10 +265,12 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
-#ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
-#endif
+      else if (!strcmp (name, "-ramdisk"))
+        configure_ramdisk (value);
+      else if (!strcmp (name, "-raid0"))
+        configure_raid0 (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -315,6 +335,8 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"iobench", 3, iobench_run},
+      {"iobench-swap", 1, iobench_swap_run},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +383,8 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  iobench DEV1 DEV2  Time reads of DEV1 and DEV2, alone and at once.\n"
+          "  iobench-swap       Time cached file system reads and swap writes.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,9 +397,9 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
-#ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
-#endif
+          "  -ramdisk=ROLE:KB   Create a KB-kilobyte RAM disk for ROLE.\n"
+          "  -raid0=BDEVS[:N]   Stripe BDEVS (e.g. hdb,hdc) into md0.\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
@@ -387,15 +411,56 @@ usage (void)
 }
 
 #ifdef FILESYS
+/* Parses VALUE, the argument to -ramdisk, which has the form
+   ROLE:KB, e.g. "swap:4096". */
+static void
+configure_ramdisk (char *value)
+{
+  char *role, *size, *save_ptr;
+  enum block_type type;
+
+  if (value == NULL)
+    PANIC ("-ramdisk requires an argument of the form ROLE:KB");
+  role = strtok_r (value, ":", &save_ptr);
+  size = strtok_r (NULL, "", &save_ptr);
+  if (role == NULL || size == NULL || atoi (size) <= 0)
+    PANIC ("-ramdisk requires an argument of the form ROLE:KB");
+
+  for (type = BLOCK_FILESYS; type < BLOCK_ROLE_CNT; type++)
+    if (!strcmp (role, block_type_name (type)))
+      break;
+  if (type == BLOCK_ROLE_CNT)
+    PANIC ("-ramdisk: unknown role `%s'", role);
+
+  ramdisk_role = type;
+  ramdisk_size_kb = atoi (size);
+}
+
+/* Parses VALUE, the argument to -raid0, which has the form
+   BDEV,BDEV...[:SECTORS], e.g. "hdb,hdc:16". */
+static void
+configure_raid0 (char *value)
+{
+  char *members, *chunk, *save_ptr;
+
+  if (value == NULL)
+    PANIC ("-raid0 requires an argument of the form BDEV,BDEV...[:SECTORS]");
+  members = strtok_r (value, ":", &save_ptr);
+  chunk = strtok_r (NULL, "", &save_ptr);
+  if (members == NULL || (chunk != NULL && atoi (chunk) <= 0))
+    PANIC ("-raid0 requires an argument of the form BDEV,BDEV...[:SECTORS]");
+
+  raid0_members = members;
+  raid0_chunk = chunk != NULL ? atoi (chunk) : 0;
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices (void)
 {
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
-#ifdef VM
   locate_block_device (BLOCK_SWAP, swap_bdev_name);
-#endif
 }
 
 /* Figures out what block device to use for the given ROLE: the
@@ -1,12 +1,15 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "lib/user/syscall.h"
 #include "devices/shutdown.h"
 #include "devices/input.h"
+#include "devices/block.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -18,6 +21,12 @@
 
 static void syscall_handler (struct intr_frame *);
 static struct file_descriptor *getfile (struct thread *t, int fd, int searchdir);
+static void get_args (const uint32_t *esp, uint32_t *args, int cnt);
+static char *copy_in_string (const char *ustr);
+static bool user_range_ok (const void *uaddr, size_t size, bool write);
+static bool copy_from_user (void *dst, const void *usrc, size_t size);
+static bool copy_to_user (void *udst, const void *src, size_t size);
+static int strncpy_from_user (char *dst, const char *usrc, size_t size);
 
 
 void
@@ -30,16 +39,18 @@ syscall_init (void)
 static void
 syscall_handler (struct intr_frame *f) 
 {
-  int sys_code = *(int*)f->esp;
   uint32_t *esp = f->esp;
+  uint32_t args[3];
+  int sys_code;
 
-  /* Validate potential addrs */
-  if (!validate_addr((void *) esp))
+  /* Fetch the syscall number */
+  if (!copy_from_user (&sys_code, esp, sizeof sys_code))
   {
     exit(-1);
   }
   
-  /* Switch by the syscall code. For each syscall, check each argument before calling. */
+  /* Switch by the syscall code. For each syscall, copy in its
+     arguments, and any strings they point to, before calling. */
   switch (sys_code)
   {
     case SYS_HALT:
@@ -49,194 +60,142 @@ syscall_handler (struct intr_frame *f)
     }
     case SYS_EXIT:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int status = *(esp + 1);
+      get_args (esp, args, 1);
+      int status = args[0];
       exit(status);
       break;
     }
     case SYS_EXEC:
     {
-      if (!validate_addr((void *) esp) 
-      || !validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-
-      char *cmd_line = (char *)(*(esp + 1));
-      if(!validate_string(cmd_line))
-        exit(-1);
-      
+      get_args (esp, args, 1);
+      char *cmd_line = copy_in_string ((const char *) args[0]);
       f->eax = (uint32_t) exec(cmd_line);
+      palloc_free_page (cmd_line);
       break;
     }
     case SYS_WAIT:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      pid_t pid = *(esp + 1);
+      get_args (esp, args, 1);
+      pid_t pid = args[0];
       f->eax = (uint32_t) wait (pid);
       break;
     }
     case SYS_CREATE:
     {
-      if (!validate_addr((void *) (esp + 1)) 
-      || !validate_addr((void *) (esp + 2)))
-      {
-        exit(-1);
-      }
-      char *file = (char *) *(esp + 1);
-      unsigned initial_size = *(esp + 2);
+      get_args (esp, args, 2);
+      char *file = copy_in_string ((const char *) args[0]);
+      unsigned initial_size = args[1];
       f->eax = (uint32_t) create (file, initial_size);
+      palloc_free_page (file);
       break;
     }
     case SYS_REMOVE:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      char *file = (char *)* (esp + 1);
+      get_args (esp, args, 1);
+      char *file = copy_in_string ((const char *) args[0]);
       f->eax = (uint32_t) remove (file);
+      palloc_free_page (file);
       break;
     }
     case SYS_OPEN:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      char *file = (char *)* (esp + 1);
+      get_args (esp, args, 1);
+      char *file = copy_in_string ((const char *) args[0]);
       f->eax = (uint32_t) open (file);
+      palloc_free_page (file);
       break;
     }
     case SYS_FILESIZE:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
+      get_args (esp, args, 1);
+      int fd = args[0];
       f->eax = (uint32_t) filesize (fd);
       break;
     }
     case SYS_READ:
     {
-      if (!validate_addr((void *) (esp + 1)) 
-      || !validate_addr((void *) (esp + 2)) 
-      || !validate_addr((void *) (esp + 3)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
-      void *buffer = (void *)*(esp + 2);
-      unsigned size = *(esp + 3);
+      get_args (esp, args, 3);
+      int fd = args[0];
+      void *buffer = (void *) args[1];
+      unsigned size = args[2];
       f->eax = (uint32_t) read (fd, buffer, size);
       break;
     }
     case SYS_WRITE:
     {
-      if (!validate_addr((void *) (esp + 1)) 
-      || !validate_addr((void *) (esp + 2)) 
-      || !validate_addr((void *) (esp + 3)))
-      {
-        exit(-1);
-      }
-      int fd = *((int*)f->esp + 1);
-      void* buffer = (void*)(*((int*)f->esp + 2));
-      unsigned size = *((unsigned*)f->esp + 3);
+      get_args (esp, args, 3);
+      int fd = args[0];
+      void *buffer = (void *) args[1];
+      unsigned size = args[2];
       f->eax = write(fd, buffer, size);
       break;
     }
     case SYS_SEEK:
     {
-      if (!validate_addr((void *) (esp + 1)) 
-      || !validate_addr((void *) (esp + 2)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
-      unsigned position = *(esp + 2);
+      get_args (esp, args, 2);
+      int fd = args[0];
+      unsigned position = args[1];
       seek (fd, position);
       break;
     }
     case SYS_TELL:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
+      get_args (esp, args, 1);
+      int fd = args[0];
       f->eax = (uint32_t) tell (fd);
       break;
     }
     case SYS_CLOSE:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
+      get_args (esp, args, 1);
+      int fd = args[0];
       close (fd);
       break;
     }
     case SYS_CHDIR:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      const char* dir = (const char*) *(esp + 1);
+      get_args (esp, args, 1);
+      char *dir = copy_in_string ((const char *) args[0]);
       f->eax = (uint32_t) chdir(dir);
+      palloc_free_page (dir);
       break;
     }
     case SYS_MKDIR:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      const char* dir = (const char*) *(esp + 1);
+      get_args (esp, args, 1);
+      char *dir = copy_in_string ((const char *) args[0]);
       f->eax = (uint32_t) mkdir(dir);
+      palloc_free_page (dir);
       break;
     }
     case SYS_READDIR:
     {
-      if (!validate_addr((void *) (esp + 1)) 
-      || !validate_addr((void *) (esp + 2)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
-      char *name = (char*) *(esp + 2);
+      get_args (esp, args, 2);
+      int fd = args[0];
+      char *name = (char *) args[1];
 
       f->eax = (uint32_t) readdir(fd, name);
       break;
     }
     case SYS_ISDIR:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
+      get_args (esp, args, 1);
+      int fd = args[0];
       f->eax = (uint32_t) isdir(fd);
       break;
     }
     case SYS_INUMBER:
     {
-      if (!validate_addr((void *) (esp + 1)))
-      {
-        exit(-1);
-      }
-      int fd = *(esp + 1);
+      get_args (esp, args, 1);
+      int fd = args[0];
       f->eax = inumber(fd);
       break;
     }
+    case SYS_IOSTAT:
+    {
+      iostat();
+      break;
+    }
     default:
       break;
   }
@@ -318,9 +277,6 @@ Creating a new file does not open it: opening the new file
 is a separate operation which would require a open system call. */
 bool
 create (const char *file, unsigned initial_size){
-  if(!validate_addr((void *) file)){
-    exit(-1);
-  }
   lock_acquire (&file_lock);
   bool status = filesys_create (file, initial_size, false);
   lock_release (&file_lock);
@@ -331,9 +287,6 @@ create (const char *file, unsigned initial_size){
 false otherwise. */
 bool
 remove (const char *file){
-  if(!validate_addr((void *) file)){
-    exit(-1);
-  }
   bool status = false;
   lock_acquire (&file_lock);
   status = filesys_remove (file);
@@ -347,9 +300,6 @@ or -1 if the file could not be opened.
 File descriptors numbered 0 and 1 are reserved for the console */
 int
 open (const char *file){
-  if(!validate_addr((void *) file)){
-    exit(-1);
-  }
   struct file_descriptor *file_desc = malloc (sizeof (struct file_descriptor));
   struct thread *cur = thread_current ();
   lock_acquire (&file_lock);
@@ -396,9 +346,8 @@ read (int fd, void *buffer, unsigned length){
   if (fd == 1)
     return -1;
 
-  if(!validate_addr((void *) buffer)){
+  if (!user_range_ok (buffer, length, true))
     exit(-1);
-  }
   
   int size = 0;
   struct file_descriptor *file_desc = getfile (thread_current(), fd, 0);
@@ -429,9 +378,8 @@ write (int fd, const void *buffer, unsigned length){
   if (fd == 0)
     return -1;
 
-  if(!validate_addr((void *) buffer)){
+  if (!user_range_ok (buffer, length, false))
     exit(-1);
-  }
   int size = 0 ;
 
   
@@ -501,10 +449,6 @@ false on failure. */
 bool
 chdir (const char *dir)
 {
-  if(!validate_addr((void *) dir)){
-    exit(-1);
-  }
-
   bool status = false;
 
   lock_acquire (&file_lock);
@@ -519,10 +463,6 @@ Returns true if successful, false on failure. Fails if dir already exists
 or if any directory name in dir, besides the last, does not already exist. */
 bool
 mkdir (const char *dir){
-  if(!validate_addr((void *) dir)){
-    exit(-1);
-  }
-
   bool status = false;
 
   lock_acquire (&file_lock);
@@ -541,8 +481,12 @@ returns false. */
 bool
 readdir (int fd, char *name){
   struct file_descriptor *file_desc = getfile (thread_current(), fd, 1);
+  char kname[READDIR_MAX_LEN + 1];
   bool status = false;
 
+  if (!user_range_ok (name, sizeof kname, true))
+    exit(-1);
+
   if (file_desc == NULL)
     return status;
 
@@ -555,8 +499,10 @@ readdir (int fd, char *name){
     return status;
 
   lock_acquire (&file_lock);
-  status = dir_readdir (file_desc->dir, name);
+  status = dir_readdir (file_desc->dir, kname);
   lock_release (&file_lock);
+  if (status && !copy_to_user (name, kname, strlen (kname) + 1))
+    exit(-1);
   return status;
 
 }
@@ -582,6 +528,15 @@ inumber (int fd){
   return num;
 }
 
+/* Prints each block device's request latency histogram and
+queue depth, and the most recent block requests, to the
+console.  A debugging aid for finding where I/O stalls. */
+void
+iostat (void)
+{
+  block_print_stats ();
+}
+
 
 /*------------------------- Helper functions -------------------------*/
 
@@ -609,38 +564,118 @@ getfile (struct thread *t, int fd, int searchdir)
   return NULL;
 }
 
-bool validate_addr(void *ptr)
+/* Copies the first CNT arguments of a system call, from the user
+   stack at ESP, into ARGS.  Terminates the process if they are
+   not all in its memory. */
+static void
+get_args (const uint32_t *esp, uint32_t *args, int cnt)
 {
-  if (ptr == NULL)
-    return false;
-  else
+  if (!copy_from_user (args, esp + 1, cnt * sizeof *args))
+    exit(-1);
+}
+
+/* Returns a copy of the null-terminated string at user address
+   USTR, in a page of its own, which the caller must free with
+   palloc_free_page().  Terminates the process if the string is
+   not all in its memory, or does not fit in a page. */
+static char *
+copy_in_string (const char *ustr)
+{
+  char *kstr = palloc_get_page (0);
+  if (kstr == NULL)
+    exit(-1);
+  int len = strncpy_from_user (kstr, ustr, PGSIZE);
+  if (len < 0 || len == PGSIZE)
   {
-    int byte_count = 0;
-    for (int i = 0; i < 4; i++)
-    {
-      /* If every byte of ptr < PHYS_BASE and if belongs to current thread */
-      if (is_user_vaddr(ptr+i) && (pagedir_get_page(thread_current()->pagedir, ptr+i) != NULL))
-        byte_count++;
-    }
-    if (byte_count == 4)
-      return true;
+    palloc_free_page (kstr);
+    exit(-1);
   }
-  return false;
+  return kstr;
 }
 
-bool validate_string (char *str)
+/* Returns true if all SIZE bytes starting at user address UADDR
+   are mapped in the current process, and, if WRITE is true,
+   mapped writable.  A kernel write to a read-only user page
+   would be a rights violation in kernel context, which kills the
+   kernel, so it must be refused here.  Looks each page up once,
+   however large SIZE is.
+   A null pointer is never valid, even for SIZE 0. */
+static bool
+user_range_ok (const void *uaddr, size_t size, bool write)
 {
-  if (str == NULL)
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *p = uaddr;
+  const uint8_t *page = pg_round_down (uaddr);
+
+  if (uaddr == NULL || !is_user_vaddr (uaddr)
+      || size > (size_t) ((const uint8_t *) PHYS_BASE - p))
     return false;
 
-  char *ch = str;
-  while(true)
+  do
   {
-    if (!validate_addr((void *) ch))
+    if (pagedir_get_page (pd, page) == NULL
+        || (write && !pagedir_is_writable (pd, page)))
       return false;
-    if (*ch == '\0')
-      return true;
-    ++ch;
+    page += PGSIZE;
+  }
+  while (page < p + size);
+  return true;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns true
+   if successful, false if any of them is not in the current
+   process's memory, in which case nothing is copied. */
+static bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  if (!user_range_ok (usrc, size, false))
+    return false;
+  memcpy (dst, usrc, size);
+  return true;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns true
+   if successful, false if any of them is not in the current
+   process's memory or is read-only, in which case nothing is
+   copied. */
+static bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  if (!user_range_ok (udst, size, true))
+    return false;
+  memcpy (udst, src, size);
+  return true;
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes, a page of the string at a
+   time.  Returns the length of the string, or SIZE if it did not
+   fit, in which case DST is not null-terminated.  Returns -1 if
+   the string runs into memory the current process does not have. */
+static int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t len = 0;
+
+  if (usrc == NULL)
+    return -1;
+  while (len < size)
+  {
+    const char *p = usrc + len;
+    size_t chunk = PGSIZE - pg_ofs (p);
+
+    if (!is_user_vaddr (p) || pagedir_get_page (pd, p) == NULL)
+      return -1;
+
+    /* Copy to the end of this page, or of the string */
+    if (chunk > size - len)
+      chunk = size - len;
+    while (chunk-- > 0)
+    {
+      if ((dst[len++] = *p++) == '\0')
+        return len - 1;
+    }
   }
-  return false;
+  return size;
 }
@@ -11,9 +11,6 @@ struct lock file_lock;
 
 void syscall_init (void);
 
-bool validate_addr(void *ptr);
-bool validate_string(char *str);
-
 void halt (void);
 void exit (int status);
 pid_t exec (const char *cmd_line);
@@ -34,4 +31,6 @@ bool readdir (int fd, char *name);
 bool isdir (int fd);
 int inumber (int fd);
 
+void iostat (void);
+
 #endif /* userprog/syscall.h */